@@ -7,6 +7,34 @@
 #include <cctype>
 #include <stdlib.h>
 #include <ctime>
+#include <cstring>
+#include <cstdint>
+#include <deque>
+#include <sstream>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <sys/resource.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <string_view>
+#include <charconv>
+#include <memory>
+#include <condition_variable>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Derivative_Calculator.h"
 
 using namespace std;
 
@@ -16,8 +44,8 @@ using namespace std;
 // The code prompts the user to enter the function x'(t), as well as several parameters such as the 
 // calculation interval and the exact solution x(t) (for error calculations).
 
-// Step 1) Code parses input string and computes derivative of corresponding function using standard
-// laws of calculus. Outputs these derivatives to the standard output.
+// Step 1) Code parses input string into an expression DAG and computes derivative of corresponding function
+// using standard laws of calculus. Outputs these derivatives to the standard output.
 // Step 2) Code takes the resulting strings representing the n derivatives of the input function and
 // again parses them so that they can be used as functions of x and t.
 // Step 3) Code uses computed derivatives to solve Problem 1 of Final Project via the Taylor Method.
@@ -29,773 +57,6091 @@ using namespace std;
 // Define structures used when parsing strings.
 
 
-// STRUCTURE Terms Sum Difference
+// STRUCTURE Parse Error
 
-// Structure that holds information about terms in a sum or difference. It can contain an arbitrary 
-// number of terms because when differentiating a sum/difference, we differentiate each and then
-// add/subtract them.
-struct terms_sum_difference{
-	vector<string> terms; // vector holding the added/subtracted terms
-	vector<int> indices; // vector holding the indices of the + or - terms comprising the sum/difference
-	vector<char> symbols; // vector holding the character (+ or -) at each of the indices
+// Structure that says why a string could not be parsed: 'position' is the offset of the character where parsing
+// stopped (0 for the first character), and 'message' describes what was found there. 'message' is empty if there was
+// no error.
+struct parse_error{
+	size_t position=0; // offset of the offending character in the string
+	string message; // what went wrong, such as "expected ')'"
 };
 
-// STRUCTURE Terms Product Quotient
+// STRUCTURE Token
+
+// Structure that holds one token of an expression string. The text is a view of the string being parsed, so no token
+// copies any characters. A name is followed by any number of apostrophes, which are counted in 'order' rather than
+// kept in the text, so x''' is the name x of order 3.
+enum token_type {NUMBER_TOKEN, NAME_TOKEN, OPERATOR_TOKEN, END_TOKEN, INVALID_TOKEN};
+struct token{
+	token_type type;
+	string_view text; // characters of the token (for a name, without its apostrophes)
+	size_t position; // offset of the first character in the string
+	double value; // value of a number
+	int order; // number of apostrophes after a name
+};
+
+// STRUCTURE Parser
+
+// Structure that holds the state of a parse: the string, the token being looked at, and the offset just after it. The
+// string is read once from left to right; each token is made only when the previous one has been used.
+struct parser{
+	string_view source; // string being parsed
+	size_t position=0; // offset just after 'current'
+	token current; // token being looked at
+	parse_error error; // first error found, if any
+};
+
+
+// STRUCTURE Arena
+
+// Structure that hands out memory from large blocks, for objects that all die together. Allocating is a pointer bump,
+// nothing is freed one object at a time, and arena_reset or an arena_scope gives back everything allocated after a given
+// point at once. Blocks are kept for reuse rather than returned to the heap, so once an arena has grown to the size a job
+// needs, running the job again allocates nothing. An arena must not be copied, since containers point to it.
+const size_t arena_block_size=1<<16;
+
+struct arena_position{
+	int block; // index of the block being filled
+	size_t used; // bytes used in that block
+};
+
+struct arena{
+	vector<pair<char *, size_t> > blocks; // start and size of each block, in order of use
+	arena_position top={0, 0}; // next free byte
+	size_t bytes=0; // bytes handed out since the arena was last reset, for the benchmark
+	arena() {}
+	arena(const arena &)=delete;
+	arena & operator=(const arena &)=delete;
+	~arena(){
+		for (int i=0; i<blocks.size(); i++)
+			free(blocks[i].first);
+	}
+};
+
+void * arena_allocate(arena &, size_t, size_t); // used by arena_allocator, and defined with the arena functions
+
+// STRUCTURE Arena Allocator
+
+// Allocator that lets standard containers take their memory from an arena. Deallocating does nothing; the memory is
+// reclaimed when the arena is reset or released. Two allocators are equal if they use the same arena.
+template<class T> struct arena_allocator{
+	typedef T value_type;
+	arena * memory; // arena that memory is taken from
+	arena_allocator(arena * m): memory(m) {}
+	template<class U> arena_allocator(const arena_allocator<U> & other): memory(other.memory) {}
+	T * allocate(size_t n) {return (T *)arena_allocate(*memory, n*sizeof(T), alignof(T));}
+	void deallocate(T *, size_t) {}
+};
+
+template<class T, class U> bool operator==(const arena_allocator<T> & a, const arena_allocator<U> & b) {return a.memory==b.memory;}
+template<class T, class U> bool operator!=(const arena_allocator<T> & a, const arena_allocator<U> & b) {return a.memory!=b.memory;}
+
+// STRUCTURE Arena Scope
+
+// Structure that gives back everything allocated from an arena during its lifetime when it goes out of scope. Declare it
+// before the containers that use the arena, so that they are destroyed first.
+struct arena_scope{
+	arena & memory; // arena to release
+	arena_position top; // position to release it to
+	arena_scope(arena & m): memory(m), top(m.top) {}
+	arena_scope(const arena_scope &)=delete;
+	arena_scope & operator=(const arena_scope &)=delete;
+	~arena_scope() {memory.top=top;}
+};
+
+// STRUCTURE Expression Node
+
+// Structure that holds one node of a parsed expression. Nodes are created only through an expression_pool,
+// which hash-conses them: two structurally identical subexpressions are always the same node, so an
+// expression is a DAG in which every distinct subtree exists exactly once in memory. Derivatives of a
+// function can then refer to the original function's subtrees instead of copying them.
+enum node_type {CONSTANT, VARIABLE, TIME, ADD, SUBTRACT, MULTIPLY, DIVIDE, NEGATE, EXPONENTIAL, LOGARITHM, POWER, SINE, COSINE, TANGENT};
+
+struct expression_node{
+	node_type type; // kind of node (constant, variable, operator or elementary function)
+	double value; // value of a CONSTANT node
+	int order; // derivative order of a VARIABLE node (0 for x, 1 for x', 2 for x'', etc)
+	int symbol; // symbol id of a VARIABLE node (0 for x), found once when the expression is parsed
+	const string * name; // name of the symbol of a VARIABLE node, used when writing the expression
+	const expression_node * left; // first operand (or only argument of a function), null for leaves
+	const expression_node * right; // second operand of a binary operator, null otherwise
+	size_t hash; // structural hash, computed once when the node is created
+	int id; // index of node in its pool, in order of creation
+};
+
+// STRUCTURE Expression Pool
+
+// Structure that owns all expression nodes and guarantees that each distinct node is created only once. It also interns
+// the names of the symbols that may be differentiated: each name gets an integer id when first added, and a VARIABLE
+// node holds that id and its derivative order, so x''''' is found with one hash lookup however high its order.
+struct expression_node_hash{
+	size_t operator()(const expression_node * node) const {return node->hash;}
+};
+
+struct expression_node_equal{
+	bool operator()(const expression_node * a, const expression_node * b) const {
+		return (a->type==b->type)&&(memcmp(&a->value,&b->value,sizeof(double))==0)&&(a->order==b->order)&&(a->symbol==b->symbol)&&(a->left==b->left)&&(a->right==b->right);
+	}
+};
+
+// Nodes and the lookup table live in the pool's arena, so a whole generation of nodes is freed by one reset_pool, and
+// the temporaries of simplify live in a second arena that is released as each call returns.
+typedef unordered_set<const expression_node *, expression_node_hash, expression_node_equal, arena_allocator<const expression_node *> > node_index;
+
+struct expression_pool{
+	arena memory; // storage for nodes and for 'index' (nodes never move, so node pointers stay valid)
+	arena scratch; // storage for temporaries of simplify
+	node_index index; // lookup table of existing nodes
+	deque<string> symbols{"x"}; // name of each symbol, by id (a deque, so that nodes can point to the names)
+	unordered_map<string_view, int> symbol_ids{{"x", 0}}; // id of each symbol, by name (a view of its entry in 'symbols')
+	expression_pool(): index(0, expression_node_hash(), expression_node_equal(), &memory) {}
+};
+
+// Maps from node to node, and the temporaries of simplify (the parts of one sum or product, and the position of each
+// part in the list), all with their memory in an arena.
+typedef unordered_map<const expression_node *, const expression_node *, hash<const expression_node *>, equal_to<const expression_node *>, arena_allocator<pair<const expression_node * const, const expression_node *> > > node_map;
+typedef vector<pair<const expression_node *, double>, arena_allocator<pair<const expression_node *, double> > > part_list;
+typedef unordered_map<const expression_node *, int, hash<const expression_node *>, equal_to<const expression_node *>, arena_allocator<pair<const expression_node * const, int> > > position_map;
+
+// STRUCTURE Sparse Polynomial
+
+// Structure that holds a polynomial in t, x, x', x'', ... (and in other symbols and their derivatives) as a list of
+// monomials, keeping only those whose coefficient is not zero. Each monomial is a coefficient times a product of powers
+// sorted by variable, so like monomials have equal lists of powers, and the monomials themselves are sorted by their
+// powers. Adding and differentiating polynomials in this form takes time linear in the number of monomials, with no
+// intermediate expressions to simplify. An expression is only kept in this form while it has at most
+// polynomial_term_limit monomials, and only integer powers up to polynomial_power_limit are expanded; anything larger
+// takes the general path of differentiate and simplify. Like the maps of the derivative cache, every list is taken from
+// an arena: the polynomial forms kept in the cache from cache.memory, and polynomials being worked on from cache.scratch.
+const int polynomial_term_limit=4096;
+const int polynomial_power_limit=64;
+
+struct polynomial_power{
+	int symbol; // symbol id, or -1 for t
+	int order; // derivative order of the symbol
+	int power; // exponent, at least 1
+};
+
+typedef vector<polynomial_power, arena_allocator<polynomial_power> > power_list;
+
+struct monomial{
+	double coefficient;
+	power_list powers; // powers of distinct variables, sorted by symbol and then order
+};
+
+typedef vector<monomial, arena_allocator<monomial> > monomial_list;
+
+struct sparse_polynomial{
+	monomial_list terms; // monomials, sorted by their powers, no two alike
+};
+
+// STRUCTURE Derivative Cache
+
+// Structure that remembers the derivative and simplified form of every node seen so far. Because nodes are hash-consed
+// and simplified into a canonical form, a pointer identifies a subexpression, and the cache can be kept across all the
+// derivative orders computed in main(): the terms of derivative k that are copied into derivative k+1 unchanged are then
+// differentiated once in total, rather than once per order. The polynomial form of each node is remembered in the same
+// way (see polynomial_form), so a polynomial derivative of one order is not converted again for the next.
+struct derivative_cache{
+	arena memory; // storage for the maps and the polynomial forms
+	arena scratch; // storage for polynomials while they are being worked on
+	node_map derivatives; // derivative of each node differentiated so far
+	node_map simplified; // simplified form of each node simplified so far
+	position_map polynomial_forms; // index in 'polynomials' of each node converted so far, or -1 if it is not a polynomial
+	vector<sparse_polynomial, arena_allocator<sparse_polynomial> > polynomials; // polynomial forms of nodes
+	vector<const expression_node *, arena_allocator<const expression_node *> > polynomial_derivatives; // derivative of polynomials[i] as an expression, or nullptr
+	long hits=0; // number of times a derivative was found in the cache
+	long misses=0; // number of times a derivative had to be computed
+	derivative_cache(): derivatives(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &memory), simplified(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &memory), polynomial_forms(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &memory), polynomials(&memory), polynomial_derivatives(&memory) {}
+};
+
+// STRUCTURE Derivative Sequence
+
+// Structure that holds x', x'', etc for one input function. Derivative k+1 is made from derivative k the first time it
+// is asked for (see sequence_term), and every order made so far is kept, so the sequence can be extended at any time,
+// even during a run, and a caller that stops at a low order never pays for the higher ones.
+struct derivative_sequence{
+	expression_pool pool; // nodes of all orders made so far
+	derivative_cache cache; // derivatives of subexpressions, kept across orders
+	vector<const expression_node *> terms; // terms[k] is derivative k+1 of x, in terms of x, t and lower derivatives
+};
+
+// STRUCTURE Derivative Session
+
+// Structure behind the derivative_session of the library interface (Derivative_Calculator.h). It keeps one pool and one
+// cache for every expression differentiated with it, so common subexpressions are built and differentiated once. Once
+// the pool holds more than session_node_limit nodes it is emptied before the next expression, so a long batch does not
+// use unbounded memory.
+const size_t session_node_limit=1<<20;
+
+struct derivative_session{
+	expression_pool pool; // nodes of all expressions differentiated so far
+	derivative_cache cache; // derivatives and simplified forms of those nodes
+	parse_error error; // why the last expression could not be parsed, if it could not
+};
+
+// STRUCTURE Batch Line
+
+// Structure that holds one input line of batch mode and the JSON written for it.
+struct batch_line{
+	string function; // x'(x,t)
+	int terms; // number of terms asked for
+	string output; // JSON object written for this line
+	bool ok; // false if the line could not be read or differentiated
+};
+
+// STRUCTURE Instruction
+
+// Structure that holds one step of a compiled expression. Instruction i of a compiled expression writes its result to
+// register i, reading its operands from registers written by earlier instructions, so a whole expression is a flat list
+// that is run from start to end with no parsing or recursion over the string.
+struct instruction{
+	node_type type; // operation, using the same kinds as expression nodes
+	int left; // register holding first operand (or only argument of a function)
+	int right; // register holding second operand of a binary operator
+	double value; // value of a CONSTANT
+	int order; // derivative order of a VARIABLE
+	int symbol; // symbol id of a VARIABLE
+};
+
+// STRUCTURE Compiled Expression
+
+// Structure that holds the instructions for one expression. The result is in the register of the last instruction.
+struct compiled_expression{
+	vector<instruction> code; // instructions, in order of execution
+	int offset; // index of this expression's first register within the evaluation scratch space
+};
+
+// STRUCTURE Compiled Derivatives
+
+// Structure that holds compiled versions of x', x'', etc, followed by the exact solution, as in symbolic_derivatives.
+// It is never modified while solving, so it can be shared by any number of evaluations. If the expressions have also
+// been compiled to machine code (see jit_compile), 'native' computes all of them at once: native(x, t, v) sets v[i] to
+// the value of expression i.
+struct compiled_derivatives{
+	vector<compiled_expression> expressions; // one compiled expression per entry of symbolic_derivatives
+	int registers; // total number of registers used by all expressions
+	void (*native)(double, double, double *)=nullptr; // machine code for all expressions, or nullptr
+};
+
+// STRUCTURE Compiled System
+
+// Structure that holds the derivatives of a system x1' = f1, ..., xN' = fN, compiled into one list of instructions. The
+// derivatives of all components and orders share one set of registers, so a subexpression common to several of them is
+// computed once per step. In 'results', and in the values computed from them, derivative k of xi' is at k*N+i-1: each
+// derivative order of the whole state is contiguous (structure of arrays). VARIABLE instructions hold the index of
+// their component in place of a symbol id.
+struct compiled_system{
+	int components; // number of equations N
+	int number_of_terms; // number of Taylor terms
+	compiled_expression tape; // instructions for every derivative of every component, lowest order first
+	vector<int> results; // register holding derivative k of xi', at k*N+i-1
+};
+
+// STRUCTURE Double Double
+
+// Structure that holds a number as the unevaluated sum of two doubles, hi+lo, with |lo| no more than half an ulp of hi.
+// This gives about 32 significant digits, using only double arithmetic, for runs with many Taylor terms where rounding
+// error in double limits the accuracy. Arithmetic is exact up to the last bits of lo; the range is that of double.
+struct double_double{
+	double hi; // leading part
+	double lo; // trailing part
+	double_double(double h=0.0, double l=0.0): hi(h), lo(l) {}
+	explicit operator double() const {return hi;}
+};
+
+// STRUCTURE Evaluation Scratch
+
+// Structure that holds the registers written while running compiled expressions. It is sized once, before solving, so
+// evaluating an expression never allocates memory. 'values' caches the derivatives x', x'', etc found at the last (x,t),
+// so that each is computed once per step however many expressions refer to it. When machine code is used, 'stack'
+// holds the values of all expressions at the last (x,t) it was run for.
+// The interpreter, the jet engine and the Taylor method are templates over the number type 'scalar' (float, double,
+// long double or double_double), chosen when the program is compiled; evaluation_scratch is the double version. The
+// machine code always works in double.
+template<class scalar> struct basic_evaluation_scratch{
+	vector<scalar> registers;
+	vector<scalar> values; // value of each expression at (values_x, values_t), where 'known' is set
+	vector<char> known; // known[k] is true once expression k has been evaluated at (values_x, values_t)
+	scalar values_x, values_t; // point at which 'values' were computed
+	bool values_valid; // false until some value has been computed, or to force the next point to start afresh
+	vector<long> runs; // number of times each expression has been run since prepare_scratch, for the trace
+	long native_runs; // number of times the machine code has been run since prepare_scratch, for the trace
+	vector<double> stack; // value of every expression at (stack_x, stack_t), from compiled_derivatives::native
+	double stack_x, stack_t; // point at which 'stack' was computed
+	bool stack_valid; // false until 'stack' has been computed
+};
+
+typedef basic_evaluation_scratch<double> evaluation_scratch;
+
+// STRUCTURE Batch Scratch
+
+// Structure that holds the registers used when evaluating a compiled expression at many (x,t) points at once. Points are
+// processed in blocks of batch_lanes, and each register holds one value per point in the block, so every instruction
+// becomes a short loop over the block that the compiler turns into vector instructions.
+const int batch_lanes=32;
+
+struct batch_scratch{
+	vector<double> registers; // batch_lanes values for every register of every expression
+	vector<double> results; // batch_lanes results for every expression, used when later expressions refer to x', x'', etc
+	vector<char> needed; // flags marking the expressions that must be run to evaluate the requested one
+	double x[batch_lanes], t[batch_lanes], out[batch_lanes]; // inputs and output of the block being evaluated
+};
+
+// STRUCTURE Jet Scratch
+
+// Structure that holds truncated Taylor series (jets) for every register of the compiled x'(x,t). The jet engine
+// pushes the Taylor series of x(t) through x'(x,t) one coefficient at a time, so all Taylor coefficients of a step are
+// found without ever forming the symbolic higher derivatives. Some operations also need the series of a second function
+// (cos for sin, 1+tan^2 for tan, etc); these auxiliary series are stored after the main ones. NATIVE_ENGINE works like
+// SYMBOLIC_ENGINE, but runs the symbolic derivatives as machine code built by jit_compile.
+enum coefficient_engine {SYMBOLIC_ENGINE, JET_ENGINE, NATIVE_ENGINE};
+
+template<class scalar> struct basic_jet_scratch{
+	int length; // number of coefficients in each series (number_of_terms+1)
+	vector<scalar> series; // 'length' coefficients for each register, followed by auxiliary series
+	vector<int> aux; // index in 'series' of the first auxiliary series of each register (-1 if there are none)
+};
+
+typedef basic_jet_scratch<double> jet_scratch;
+
+// STRUCTURE Result Row
+
+// Structure that holds one row of output from the Taylor method.
+struct result_row{
+	double t; // time
+	double exact; // exact solution at t
+	double x; // Taylor solution at t
+	double error; // |exact - x|
+};
+
+// STRUCTURE Result Sink
+
+// Structure that streams rows from the Taylor method to an output file, so that memory use does not grow with the number
+// of steps. Rows are collected in a fixed-size buffer and written in large blocks, either as text (one row per line, as
+// before) or in a binary columnar format (see write_rows). A backward run produces rows in order of decreasing t; the sink
+// spills each full buffer to a temporary file and, when closed, reads the buffers back in reverse, so that both kinds of
+// run are written in order of increasing t while holding only one buffer in memory. Every 'display_every'th row written
+// is also shown on the standard output.
+enum output_format {TEXT_FORMAT, BINARY_FORMAT};
+
+const int sink_rows=4096; // number of rows held in memory by a sink
+const int sink_text_bytes=1<<16; // size of the buffer used for formatting text output
+
+struct result_sink{
+	output_format format; // format of the output file
+	bool reverse; // true if rows arrive in order of decreasing t
+	int display_every; // show every 'display_every'th row written on cout (0 to show none)
+	FILE * file; // output file
+	FILE * spill; // temporary file holding full buffers of a backward run (nullptr until one is needed)
+	long spilled; // number of buffers in 'spill'
+	bool failed; // true if rows were lost because the spill file could not be written or read back
+	long written; // number of rows written to 'file' so far
+	vector<result_row> rows; // rows not yet written or spilled
+	int count; // number of rows in 'rows'
+	vector<char> text; // text waiting to be written
+	int text_length; // number of characters in 'text'
+	vector<double> columns; // one block of binary output, arranged by column
+};
+
+// STRUCTURE Mapped Results
+
+// Structure that gives read access to a binary result file without reading it into memory. The file is mapped with mmap,
+// and the location of each block is found once when the file is opened.
+struct mapped_results{
+	const char * data; // start of the mapped file
+	size_t size; // size of the mapped file in bytes
+	long rows; // total number of rows
+	vector<long> first_row; // index of the first row in each block
+	vector<const double *> block; // start of the t column of each block
+	vector<long> block_rows; // number of rows in each block
+};
+
+// STRUCTURE Step Control
+
+// Structure that selects between fixed steps of width h and adaptive steps, and reports how many steps were taken. In
+// adaptive mode each step is sized so that the last term of the Taylor series, which estimates the local truncation
+// error, stays below absolute_tolerance + relative_tolerance*|x|. If max_terms is more than the number of terms, adaptive
+// mode may also raise the order during the run, taking the new derivatives from 'sequence' (see worth_raising_order).
+// A run is given up, and 'failed' set, if x stops being finite, or in adaptive mode if the error estimate is not a
+// number, or a trial step has to be shortened below min_step or rejected more than max_rejections times in a row, as
+// happens near a singularity of the solution.
+struct step_control{
+	bool adaptive=false; // false for fixed steps of width h
+	double absolute_tolerance=0; // allowed local error, independent of x
+	double relative_tolerance=0; // allowed local error, relative to |x|
+	int max_terms=0; // largest number of terms adaptive mode may raise the order to (0 to keep the order fixed)
+	derivative_sequence * sequence=nullptr; // derivatives the program was compiled from, needed to raise the order
+	double min_step=1e-12; // shortest trial step allowed in adaptive mode, relative to max(1,|t|)
+	int max_rejections=50; // most trial steps that may be rejected in a row in adaptive mode
+	long accepted=0; // number of steps taken (set by taylor)
+	long rejected=0; // number of trial steps rejected because the error estimate was too large (set by taylor)
+	int terms=0; // number of terms in use at the end of the run (set by taylor)
+	bool failed=false; // true if the run was given up before the end of the interval (set by taylor)
+	double failed_at=0; // t at which it was given up (set by taylor)
+};
+
+const double step_safety=0.9; // fraction of the largest step allowed by the error estimate that is actually taken
+const double step_min_factor=0.2; // smallest factor by which one step may be shortened
+const double step_max_factor=5.0; // largest factor by which one step may be lengthened
+
+// STRUCTURE Trace Log
+
+// Structure that holds the file written when tracing is enabled, by setting DERIVATIVE_TRACE to a file name. Each
+// event (one derivative order, one compile, one Taylor run) is written as one JSON object per line. When tracing is
+// disabled, active_trace is null, and each place that records an event costs one test of that pointer.
+struct trace_log{
+	FILE * file; // JSON lines file
+	mutex lock; // guards 'file', since batch mode differentiates on several threads
+	chrono::steady_clock::time_point start; // time at which tracing began, written with each event
+};
+
+// STRUCTURE Problem Instance
+
+// Structure that holds the parameters of one trajectory in an ensemble: the same x'(x,t) is integrated from many
+// initial conditions or over many intervals, with the meaning of each field as in solve_problem.
+struct problem_instance{
+	double xa; // initial condition
+	double a, b; // interval
+	double h; // width of subintervals
+	int forward_backward; // 1 if the initial condition is given at a, 2 if it is given at b
+};
+
+// STRUCTURE Ensemble Result
+
+// Structure that holds the end point of one trajectory in an ensemble.
+struct ensemble_result{
+	double t; // time at the end of integration (b for forward runs, a for backward runs)
+	double x; // Taylor solution at t
+	double error; // difference from the exact solution at t (or |x| if no exact solution was given)
+	long steps; // number of steps taken, or -1 if the instance has no valid number of steps (see instance_steps)
+};
+
+// STRUCTURE Work Range
+
+// Structure that holds the instances still to be run by one ensemble worker, as the index range [begin,end). The worker
+// takes instances from the front, and idle workers steal half of the remaining range from the back. Each range has its
+// own lock, and ranges are aligned to separate cache lines so that workers do not contend over them.
+struct alignas(64) work_range{
+	mutex lock; // guards begin and end
+	int begin; // next instance to run
+	int end; // one past the last instance to run
+};
+
+// STRUCTURE Parareal Control
+
+// Structure that holds the settings of a parareal run (see parareal), and reports how it went. The interval is cut into
+// 'slices' time slices. A coarse propagator of coarse_terms terms, with steps coarse_factor times as wide as the fine
+// ones (but no wider than a slice), predicts the start of each slice in turn; the fine propagator, the full Taylor
+// method, then runs every slice at once from the predicted starts, and the difference between the two corrects the
+// next prediction.
+struct parareal_control{
+	int slices=0; // number of time slices (one per worker thread if 0)
+	int coarse_terms=4; // Taylor terms of the coarse propagator
+	int coarse_factor=10; // width of the coarse steps, in fine steps
+	double tolerance=1e-12; // iteration stops once no slice start changes by more than this
+	int threads=0; // worker threads for the fine solves (one per core if 0)
+	int iterations=0; // number of fine sweeps made (set by parareal)
+	double change=0; // largest change of a slice start in the last sweep (set by parareal)
+};
+
+// STRUCTURE Parareal Team
+
+// Structure that holds what the fine workers of one parareal run share. The workers are started once per run and each
+// keeps its scratch space; for every iteration the calling thread refills 'ranges', advances 'round' and wakes them, and
+// then waits until 'running' is back to zero. 'stopping' tells them the run is over.
+struct parareal_team{
+	vector<work_range> ranges; // slices still to be run by each worker in this iteration
+	mutex lock; // guards round, running and stopping
+	condition_variable start; // signalled when an iteration begins, or when 'stopping' is set
+	condition_variable finished; // signalled when the last worker of an iteration is done
+	int round=0; // number of iterations begun
+	int running=0; // workers, besides the calling thread, still running this iteration
+	bool stopping=false; // set once no more iterations will be run
+	parareal_team(int threads) : ranges(threads) {}
+};
+
+// STRUCTURE Server Connection
+
+// Structure that holds one client of server mode (see serve): the descriptors it is read from and written to (one
+// socket, or the standard input and output), and the start of a request line not yet complete. Requests are answered
+// in the order they finish, so 'lock' keeps answers from different workers from interleaving. The descriptors are
+// closed when the last job holding the connection is done, which may be after the client has stopped sending.
+struct server_connection{
+	int in; // descriptor requests are read from
+	int out; // descriptor answers are written to
+	string pending; // characters read after the last complete line
+	mutex lock; // guards writing to 'out' and 'broken'
+	bool broken=false; // set once a write fails, after which answers are dropped
+	~server_connection(){
+		if (in>2)
+			close(in);
+		if ((out!=in)&&(out>2))
+			close(out);
+	}
+};
+
+// STRUCTURE Server Job
+
+// Structure that holds one request line waiting for a worker, with the time it was read, from which its latency is
+// measured.
+struct server_job{
+	shared_ptr<server_connection> connection; // client to answer
+	string line; // request, one JSON object
+	chrono::steady_clock::time_point received; // time the line was read
+};
+
+// STRUCTURE Server Program
+
+// Structure that holds one compiled function kept by a server worker, with the scratch space for running it, so that a
+// repeated evaluate or solve request for the same function, number of terms and engine starts at once.
+struct server_program{
+	derivative_sequence sequence; // x', x'', etc of the function
+	compiled_derivatives program; // compiled derivatives (exact solution compiled as zero)
+	evaluation_scratch scratch; // registers for evaluating 'program'
+	jet_scratch jets; // series for the jet engine
+	vector<double> values; // derivatives or Taylor coefficients at each step
+};
+
+// STRUCTURE Server Worker
+
+// Structure that holds the caches of one server worker thread: a derivative session for differentiate requests, and
+// the programs it has compiled. Each worker owns its caches, so they need no locks; once a worker holds more than
+// server_program_limit programs it empties its map before compiling another. Requests (and batch lines) for more than
+// server_term_limit terms are refused, so that one request cannot keep a worker busy, or use up memory, indefinitely.
+const int server_program_limit=256;
+const int server_term_limit=64;
+
+struct server_worker{
+	derivative_session session; // pool and derivative cache for differentiate requests
+	unordered_map<string, unique_ptr<server_program> > programs; // compiled programs, by function, terms and engine
+};
+
+// STRUCTURE Server Latency
+
+// Structure that holds the latencies of one kind of request, in microseconds, from the time the request line was read
+// to the time its answer was written. Only the last server_latency_samples are kept, in a ring, for the percentiles.
+const int server_latency_samples=1<<16;
+
+struct server_latency{
+	vector<double> samples; // latest latencies, in a ring
+	long count=0; // number of requests answered
+	long errors=0; // number of those answered with an error
+};
+
+// STRUCTURE Server State
+
+// Structure that holds what the I/O thread and the workers of server mode share: the queue of request lines, the cache
+// of answers (by request, without its id), which is emptied once it holds server_result_limit answers, and the
+// latencies of each kind of request. The I/O thread waits in poll; 'wake' is a pipe written by a worker to get it out of
+// poll when a shutdown request has been answered.
+const int server_result_limit=1<<16;
+const size_t server_line_limit=1<<20; // longest request line accepted; a client that sends a longer one is dropped
+
+struct server_state{
+	mutex lock; // guards 'queue' and 'closing'
+	condition_variable ready; // signalled when a job is queued, or when 'closing' is set
+	deque<server_job> queue; // request lines waiting for a worker
+	bool closing=false; // set once no more jobs will be queued
+	atomic<bool> stopping{false}; // set by a shutdown request
+	int wake[2]; // pipe used to wake the I/O thread
+	mutex results_lock; // guards 'results', result_hits and result_misses
+	unordered_map<string, string> results; // answers, by request without its id
+	long result_hits=0, result_misses=0;
+	atomic<long> program_hits{0}, program_misses{0}; // requests that found, or had to compile, their program
+	mutex latency_lock; // guards 'latencies'
+	unordered_map<string, server_latency> latencies; // by kind of request ("differentiate", "evaluate", ...)
+};
+
+// STRUCTURE Benchmark Result
+
+// Structure that holds the measurements from one benchmark case. 'order' is the derivative order for the derivative and
+// evaluate benchmarks, and the number of Taylor terms for the taylor benchmark. 'expression_size' is the number of DAG
+// nodes for the derivative benchmark, and the number of instructions for the others.
+struct benchmark_result{
+	string group; // "derivative", "evaluate", "taylor", "ensemble" or "scalar"
+	string problem; // input function x'(x,t)
+	int order=0; // derivative order or number of Taylor terms
+	double h=0; // width of subintervals (taylor only)
+	string engine=""; // coefficient engine (taylor, ensemble and scalar only)
+	string scalar=""; // number type used for evaluation (scalar only)
+	double error=0; // error at the end of the interval (scalar only)
+	int threads=1; // number of worker threads (ensemble only)
+	long iterations=0; // number of operations timed
+	double ns_per_op=0; // mean time per operation
+	double allocations_per_op=0; // mean number of calls to operator new per operation
+	long expression_size=0; // size of the expression the operation works on
+	long peak_rss_kb=0; // peak resident set size of the process after the case was run
+};
+
+// STRUCTURE Reference Problem
+
+// Structure that holds one of the problems from the Final Project, as entered in main().
+struct reference_problem{
+	string function; // x'(x,t)
+	string exact; // exact solution x(t)
+	double a, b; // interval
+	double xa; // initial condition
+	int forward_backward; // 1 if the initial condition is given at a, 2 if it is given at b
+};
+
+
+//////////
+
+
+// FUNCTION PROTOTYPES
+
+// ARENA FUNCTIONS - Functions used for taking memory from an arena, and giving it all back at once.
+void arena_reset(arena &);
+void reset_pool(expression_pool &);
+void reset_cache(derivative_cache &);
+
+// LEXER FUNCTIONS - Functions used for splitting a string into tokens without copying it.
+token next_token(string_view, size_t &);
+void advance(parser &);
+bool is_operator(const token &, char);
+int operator_precedence(const token &);
+const expression_node * parse_fail(parser &, const string &);
+string token_description(const token &);
+string describe_parse_error(string_view, const parse_error &);
+
+// EXPRESSION FUNCTIONS - Functions used for building, parsing and printing hash-consed expression DAGs.
+size_t combine_hash(size_t, uint64_t);
+const expression_node * make_node(expression_pool &, node_type, const expression_node *, const expression_node *, double, int, int);
+const expression_node * make_constant(expression_pool &, double);
+const expression_node * make_variable(expression_pool &, int, int);
+int intern_symbol(expression_pool &, const string &);
+const expression_node * make_time(expression_pool &);
+const expression_node * make_binary(expression_pool &, node_type, const expression_node *, const expression_node *);
+const expression_node * make_unary(expression_pool &, node_type, const expression_node *);
+bool is_constant(const expression_node *, double);
+const expression_node * parse_primary(parser &, expression_pool &);
+const expression_node * parse_unary(parser &, expression_pool &);
+const expression_node * parse_binary(parser &, expression_pool &, int);
+const expression_node * parse_expression(string_view, expression_pool &, parse_error &);
+const expression_node * parse_expression(string_view, expression_pool &);
+string number_to_string(double);
+string operand_to_string(const expression_node *, bool);
+string expression_to_string(const expression_node *);
+
+// DERIVATIVE FUNCTIONS - Functions used for computing derivatives of functions dfined by input strings.
+const expression_node * differentiate(const expression_node *, expression_pool &, derivative_cache &);
+const expression_node * output_derivative(const expression_node *, expression_pool &, derivative_cache &);
+const expression_node * product_rule(const expression_node *, const expression_node *, expression_pool &, derivative_cache &);
+const expression_node * quotient_rule(const expression_node *, const expression_node *, expression_pool &, derivative_cache &);
+bool start_sequence(derivative_sequence &, const string &, parse_error &);
+const expression_node * sequence_term(derivative_sequence &, int);
+
+// SIMPLIFY FUNCTIONS - Functions used to put expressions into a canonical form, removing redundant terms and factors.
+bool node_less(const expression_node *, const expression_node *);
+bool term_less(const pair<const expression_node *, double> &, const pair<const expression_node *, double> &);
+void collect_terms(const expression_node *, double, part_list &, position_map &, double &);
+void collect_factors(const expression_node *, double, part_list &, position_map &, double &);
+const expression_node * build_product(expression_pool &, double, part_list &);
+const expression_node * build_sum(expression_pool &, part_list &, double);
+double fold_function(node_type, double);
+const expression_node * simplify(const expression_node *, expression_pool &, node_map &);
+const expression_node * simplify_expression(const expression_node *, expression_pool &);
+int count_nodes(const expression_node *, unordered_set<const expression_node *> &);
+
+// POLYNOMIAL FUNCTIONS - Functions used for differentiating polynomials in x, its derivatives and t without the general expression path.
+bool power_less(const polynomial_power &, const polynomial_power &);
+bool monomial_less(const monomial &, const monomial &);
+bool same_powers(const monomial &, const monomial &);
+void normalize_polynomial(sparse_polynomial &);
+void multiply_power(monomial &, int, int, int);
+monomial copy_monomial(const monomial &, double, arena &);
+sparse_polynomial copy_polynomial(const sparse_polynomial &, arena &);
+sparse_polynomial add_polynomials(const sparse_polynomial &, const sparse_polynomial &, double, arena &);
+sparse_polynomial multiply_polynomials(const sparse_polynomial &, const sparse_polynomial &, arena &);
+sparse_polynomial polynomial_derivative(const sparse_polynomial &, arena &);
+int polynomial_form(const expression_node *, derivative_cache &);
+const expression_node * polynomial_expression(const sparse_polynomial &, expression_pool &);
+const expression_node * differentiate_polynomial(int, expression_pool &, derivative_cache &);
+
+// DOUBLE-DOUBLE FUNCTIONS - Functions used for arithmetic on double_double numbers, so that it can be used as a scalar type.
+double two_sum(double, double, double &);
+double quick_two_sum(double, double, double &);
+double two_product(double, double, double &);
+double_double operator+(const double_double &, const double_double &);
+double_double operator-(const double_double &);
+double_double operator-(const double_double &, const double_double &);
+double_double operator*(const double_double &, const double_double &);
+double_double operator/(const double_double &, const double_double &);
+double_double & operator+=(double_double &, const double_double &);
+double_double & operator-=(double_double &, const double_double &);
+double_double & operator*=(double_double &, const double_double &);
+double_double & operator/=(double_double &, const double_double &);
+bool operator==(const double_double &, const double_double &);
+bool operator!=(const double_double &, const double_double &);
+bool operator<(const double_double &, const double_double &);
+bool operator>=(const double_double &, const double_double &);
+double_double fabs(const double_double &);
+double_double exp(const double_double &);
+double_double log(const double_double &);
+double_double pow(const double_double &, const double_double &);
+void sin_cos(const double_double &, double_double &, double_double &);
+double_double sin(const double_double &);
+double_double cos(const double_double &);
+double_double tan(const double_double &);
+
+// COMPILE FUNCTIONS - Functions used for turning expressions into flat lists of instructions, and running them.
+int compile_node(const expression_node *, compiled_expression &, unordered_map<const expression_node *, int> &);
+bool compile_derivatives(const vector<string> &, int, compiled_derivatives &);
+bool compile_sequence(derivative_sequence &, const string &, int, coefficient_engine, compiled_derivatives &);
+void grow_compiled(derivative_sequence &, int, coefficient_engine, compiled_derivatives &);
+template<class scalar> void prepare_scratch(const compiled_derivatives &, basic_evaluation_scratch<scalar> &);
+template<class scalar> void resize_scratch(const compiled_derivatives &, basic_evaluation_scratch<scalar> &);
+template<class scalar> scalar evaluate(const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &, scalar, scalar);
+template<class scalar> scalar derivative_value(const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &, scalar, scalar);
+
+// BATCH FUNCTIONS - Functions used for evaluating a compiled expression at many points at once, using vector instructions.
+void prepare_batch_scratch(const compiled_derivatives &, batch_scratch &);
+void evaluate_batch(const compiled_derivatives &, int, batch_scratch &, const double *, const double *, double *, int);
+const char * batch_kernel_name();
+
+// JET FUNCTIONS - Functions used for computing Taylor coefficients by propagating truncated power series through x'(x,t).
+int integer_exponent(const compiled_expression &, const instruction &);
+template<class scalar> void prepare_jet_scratch(const compiled_derivatives &, int, basic_jet_scratch<scalar> &);
+template<class scalar> scalar series_product(const scalar *, const scalar *, int);
+template<class scalar> void taylor_coefficients(const compiled_derivatives &, basic_jet_scratch<scalar> &, scalar, scalar, int, scalar *);
+
+// OUTPUT FUNCTIONS - Functions used for streaming results of the Taylor method to text or binary files, and reading binary files back.
+bool open_sink(result_sink &, const char *, output_format, bool, int);
+void sink_row(result_sink &, double, double, double);
+void flush_sink_rows(result_sink &);
+void write_rows(result_sink &, result_row *, int);
+void display_row(const result_row &);
+void close_sink(result_sink &);
+bool open_mapped_results(const char *, mapped_results &);
+double mapped_value(const mapped_results &, long, int);
+void close_mapped_results(mapped_results &);
+int print_results(const char *);
+
+// JIT FUNCTIONS - Functions used for compiling derivative sets to machine code with the system C compiler.
+bool private_directory(const string &);
+bool private_file(const string &);
+bool cache_directory(const char *, const char *, string &);
+uint64_t fnv1a_hash(const string &);
+string c_constant(double);
+string jit_source(const compiled_derivatives &);
+bool jit_compile(compiled_derivatives &, bool &);
+template<class scalar> scalar dx_native(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &);
+
+// TRACE FUNCTIONS - Functions used for recording expression growth and the time spent in each phase, when tracing is enabled.
+trace_log * open_trace(const char *);
+double elapsed_ns(chrono::steady_clock::time_point);
+void write_trace(const string &);
+const expression_node * traced_derivative(const expression_node *, expression_pool &, derivative_cache &, int);
+void trace_taylor(const vector<long> &, long, coefficient_engine, int, const step_control &, double);
+
+// PROGRAM CACHE FUNCTIONS - Functions used for keeping compiled derivative sets on disk, so that later runs skip differentiating.
+string program_cache_path(const string &);
+bool save_program(const string &, const compiled_derivatives &);
+bool load_program(const string &, int, int, compiled_derivatives &);
+bool compile_function(derivative_sequence &, const string &, const string &, int, coefficient_engine, compiled_derivatives &);
+
+// TAYLOR METHOD FUNCTIONS - Functions used for implementing Taylor Method. Similar to those used in Problem 1 of Final Project.
+template<class scalar> void taylor_values(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), const compiled_derivatives &, int, coefficient_engine, basic_evaluation_scratch<scalar> &, basic_jet_scratch<scalar> &, scalar *, scalar, scalar);
+template<class scalar> scalar sum_taylor_series(const scalar *, int, coefficient_engine, scalar);
+template<class scalar> scalar last_taylor_term(const scalar *, int, coefficient_engine, scalar);
+double step_factor(double, double, int);
+template<class scalar> scalar taylor_coefficient(const scalar *, int, coefficient_engine);
+template<class scalar> bool worth_raising_order(const scalar *, int, coefficient_engine, const compiled_derivatives &, double);
+template<class scalar> scalar taylor_increment(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), const compiled_derivatives &, int, coefficient_engine, basic_evaluation_scratch<scalar> &, basic_jet_scratch<scalar> &, scalar *, scalar, scalar, scalar);
+template<class scalar> void taylor(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), scalar, scalar, scalar, long, int, const char*, compiled_derivatives &, int, coefficient_engine, output_format, step_control &, dense_solution *);
+int solve_problem(const vector<string> &, int, double, double, double, double, int, coefficient_engine, output_format, step_control &, dense_solution *);
+template<class scalar> scalar dx(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &);
+
+// DENSE OUTPUT FUNCTIONS - Functions used for keeping the Taylor polynomial of each step, and finding x between grid points.
+void start_dense(dense_solution &);
+template<class scalar> void dense_step(dense_solution &, const scalar *, int, coefficient_engine, scalar, scalar);
+void finish_dense(dense_solution &, double, bool);
+int dense_find(const dense_solution &, double);
+double dense_polynomial(const dense_solution &, int, double);
+
+// SYSTEM FUNCTIONS - Functions used for differentiating and solving systems of equations in x1, x2, ..., xN.
+int name_components(int, expression_pool &);
+bool system_derivatives(const vector<string> &, int, expression_pool &, derivative_cache &, vector<const expression_node *> &);
+bool compile_system(const vector<const expression_node *> &, int, int, const expression_pool &, compiled_system &);
+template<class scalar> void evaluate_system(const compiled_system &, scalar *, const scalar *, scalar, scalar *);
+template<class scalar> void sum_taylor_system(const scalar *, int, int, scalar, scalar *, scalar *);
+template<class scalar> void write_system_row(FILE *, scalar, const vector<scalar> &);
+template<class scalar> void taylor_system(const compiled_system &, scalar, vector<scalar> &, scalar, long, int, FILE *);
+vector<string> split_list(const string &, char);
+int system_command(int, char * []);
+
+// ENSEMBLE FUNCTIONS - Functions used for integrating many problem instances in parallel with a shared compiled program.
+template<class scalar> void propagate(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), const compiled_derivatives &, int, coefficient_engine, basic_evaluation_scratch<scalar> &, basic_jet_scratch<scalar> &, scalar *, scalar &, scalar &, scalar, long);
+long instance_steps(const problem_instance &);
+template<class scalar> ensemble_result integrate_instance(const compiled_derivatives &, int, coefficient_engine, const problem_instance &, basic_evaluation_scratch<scalar> &, basic_jet_scratch<scalar> &, scalar *);
+int next_instance(vector<work_range> &, int);
+void ensemble_worker(const compiled_derivatives &, int, coefficient_engine, const vector<problem_instance> &, vector<ensemble_result> &, vector<work_range> &, int);
+void solve_ensemble(const compiled_derivatives &, int, coefficient_engine, const vector<problem_instance> &, vector<ensemble_result> &, int);
+
+// PARAREAL FUNCTIONS - Functions used for running one long trajectory on many cores, by iterating over time slices.
+void parareal_slices(const compiled_derivatives &, int, coefficient_engine, const vector<double> &, const vector<double> &, const vector<long> &, double, vector<double> &, vector<work_range> &, int, evaluation_scratch &, jet_scratch &, double *);
+void parareal_worker(const compiled_derivatives &, int, coefficient_engine, const vector<double> &, const vector<double> &, const vector<long> &, double, vector<double> &, parareal_team &, int);
+void parareal(const compiled_derivatives &, int, coefficient_engine, double, double, double, long, parareal_control &, vector<double> &, vector<double> &);
+int parareal_command(int, char * []);
+
+// LIBRARY FUNCTIONS - Functions used for differentiating many expressions, from other programs or in batch mode.
+string json_escape(const string &);
+size_t json_value_position(const string &, const string &);
+bool json_field(const string &, const string &, string &);
+void read_batch_line(const string &, int, batch_line &);
+void differentiate_batch_line(derivative_session *, batch_line &);
+void batch_worker(vector<batch_line> &, atomic<int> &, derivative_session *);
+int batch_command(int, char * []);
+
+// SERVER FUNCTIONS - Functions used for answering differentiate, evaluate and solve requests from a long-running process.
+string json_number(double);
+double server_percentile(vector<double> &, double);
+void record_latency(server_state &, const string &, double, bool);
+string server_stats(server_state &);
+server_program * server_program_for(server_worker &, server_state &, const string &, int, coefficient_engine, string &);
+string server_answer(server_state &, server_worker &, const string &, string &, bool &);
+void send_answer(server_connection &, const string &);
+void server_worker_loop(server_state &);
+int open_server_socket(const char *);
+void serve(server_state &, int, shared_ptr<server_connection>);
+int serve_command(int, char * []);
+
+// BENCHMARK FUNCTIONS - Functions used for timing the derivative, evaluation and Taylor stages and recording the results.
+void name_derivatives(int, vector<string> &);
+bool symbolic_derivative_strings(const string &, const string &, int, vector<string> &);
+long peak_rss_kb();
+template<class operation> void time_operation(operation, long, benchmark_result &);
+template<class scalar> benchmark_result time_scalar(const compiled_derivatives &, int, coefficient_engine, const reference_problem &, const char *);
+void write_benchmark_json(const vector<benchmark_result> &, const char *);
+int run_benchmarks(const char *);
+
+///////////
+
+
+// START ARENA FUNCTIONS
+
+
+// FUNCTION - Arena Allocate
+
+// Returns 'bytes' bytes from 'memory', aligned to 'align'. A request that does not fit in the rest of the current block
+// moves on to the next block, adding one (at least large enough for the request) if all have been used.
+void * arena_allocate(arena & memory, size_t bytes, size_t align){
+	arena_position & top=memory.top;
+	for (;;){ // Until a block with room is found...
+		if (top.block<memory.blocks.size()){
+			size_t start=(top.used+align-1)&~(align-1);
+			if (start+bytes<=memory.blocks[top.block].second){
+				top.used=start+bytes;
+				memory.bytes+=bytes;
+				return memory.blocks[top.block].first+start;
+			}
+			top.block++; // Move on to the next block.
+			top.used=0;
+		}
+		else{ // All blocks are in use, so add one.
+			size_t size=max(arena_block_size, bytes+align);
+			char * block=(char *)malloc(size);
+			if (block==nullptr)
+				throw bad_alloc();
+			memory.blocks.push_back(make_pair(block, size));
+		}
+	}
+}
+
+
+// FUNCTION - Arena Reset
+
+// Gives back everything allocated from 'memory'. The blocks are kept for reuse.
+void arena_reset(arena & memory){
+	memory.top.block=0;
+	memory.top.used=0;
+	memory.bytes=0;
+}
+
+
+// FUNCTION - Reset Pool
+
+// Frees every node of 'pool' at once. The symbols are kept, so ids found before the reset stay valid.
+void reset_pool(expression_pool & pool){
+	{
+		node_index empty(0, expression_node_hash(), expression_node_equal(), &pool.memory);
+		pool.index.swap(empty); // The old table is destroyed with 'empty', before its memory is given back.
+	}
+	arena_reset(pool.memory);
+	arena_reset(pool.scratch);
+}
+
+
+// FUNCTION - Reset Cache
+
+// Empties 'cache' and frees its memory at once.
+void reset_cache(derivative_cache & cache){
+	{
+		node_map empty_derivatives(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &cache.memory);
+		node_map empty_simplified(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &cache.memory);
+		position_map empty_forms(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &cache.memory);
+		vector<sparse_polynomial, arena_allocator<sparse_polynomial> > empty_polynomials(&cache.memory);
+		vector<const expression_node *, arena_allocator<const expression_node *> > empty_polynomial_derivatives(&cache.memory);
+		cache.derivatives.swap(empty_derivatives);
+		cache.simplified.swap(empty_simplified);
+		cache.polynomial_forms.swap(empty_forms);
+		cache.polynomials.swap(empty_polynomials);
+		cache.polynomial_derivatives.swap(empty_polynomial_derivatives);
+	}
+	arena_reset(cache.memory);
+	arena_reset(cache.scratch);
+	cache.hits=0;
+	cache.misses=0;
+}
+
+// END ARENA FUNCTIONS
+
+
+
+// START LEXER FUNCTIONS
+
+
+// FUNCTION - Next Token
+
+// Reads the token that starts at 'position' in 'source', skipping any spaces before it, and moves 'position' to just
+// after it. Numbers are read in place with from_chars, so no part of the string is copied.
+token next_token(string_view source, size_t & position){
+	while ((position<source.size())&&isspace((unsigned char)source[position]))
+		position++;
+	token result={END_TOKEN, source.substr(position,0), position, 0.0, 0};
+	if (position==source.size())
+		return result;
+	char c=source[position];
+	if (isdigit((unsigned char)c)||(c=='.')){ // If this is a number...
+		from_chars_result number=from_chars(source.data()+position, source.data()+source.size(), result.value);
+		if (number.ec!=errc()){ // Only "." or an exponent that overflows can fail here.
+			result.type=INVALID_TOKEN;
+			result.text=source.substr(position,1);
+			position++;
+			return result;
+		}
+		result.type=NUMBER_TOKEN;
+		result.text=source.substr(position, number.ptr-(source.data()+position));
+	} else if (isalpha((unsigned char)c)||(c=='_')){ // If this is a name...
+		size_t end=position+1;
+		while ((end<source.size())&&(isalnum((unsigned char)source[end])||(source[end]=='_')))
+			end++;
+		result.type=NAME_TOKEN;
+		result.text=source.substr(position, end-position);
+		while ((end<source.size())&&(source[end]=='\'')){ // Count the apostrophes after it.
+			result.order++;
+			end++;
+		}
+		position=end;
+		return result;
+	} else {
+		result.type=(strchr("+-*/(),", c)!=nullptr)?OPERATOR_TOKEN:INVALID_TOKEN;
+		result.text=source.substr(position,1);
+	}
+	position+=result.text.size();
+	return result;
+}
+
+
+// FUNCTION - Advance
+
+// Moves 'state' on to the next token.
+void advance(parser & state){
+	state.current=next_token(state.source, state.position);
+}
+
+
+// FUNCTION - Is Operator
+
+// Returns true if 'current' is the operator or bracket 'symbol'.
+bool is_operator(const token & current, char symbol){
+	return (current.type==OPERATOR_TOKEN)&&(current.text[0]==symbol);
+}
+
+
+// FUNCTION - Operator Precedence
+
+// Returns how tightly a binary operator binds: 2 for * and /, 1 for + and -, and 0 if 'current' is not a binary operator.
+int operator_precedence(const token & current){
+	if (is_operator(current,'*')||is_operator(current,'/'))
+		return 2;
+	if (is_operator(current,'+')||is_operator(current,'-'))
+		return 1;
+	return 0;
+}
+
+
+// FUNCTION - Parse Fail
+
+// Records that parsing stopped at 'current', unless an earlier error has already been recorded. Always returns null, so
+// that the parse functions can return its result directly.
+const expression_node * parse_fail(parser & state, const string & message){
+	if (state.error.message.empty()){
+		state.error.position=state.current.position;
+		state.error.message=message;
+	}
+	return nullptr;
+}
+
+
+// FUNCTION - Token Description
+
+// Describes 'current' for an error message, such as 'x' or "the end of the expression".
+string token_description(const token & current){
+	if (current.type==END_TOKEN)
+		return "the end of the expression";
+	return "'"+string(current.text)+string(current.order,'\'')+"'";
+}
+
+
+// FUNCTION - Describe Parse Error
+
+// Returns a message such as "could not parse exp(t* at character 7: expected an expression, found the end of the
+// expression", counting characters from 1.
+string describe_parse_error(string_view source, const parse_error & error){
+	return "could not parse "+string(source)+" at character "+to_string(error.position+1)+": "+error.message;
+}
+
+// END LEXER FUNCTIONS
+
+
+
+// START EXPRESSION FUNCTIONS
+
+
+// FUNCTION - Combine Hash
+
+// Mixes the hash of one field of a node into the running hash of the node.
+size_t combine_hash(size_t seed, uint64_t value){
+	return seed^(value+0x9E3779B97F4A7C15ULL+(seed<<6)+(seed>>2));
+}
+
+
+// FUNCTION - Make Node
+
+// Returns the unique node with the given contents, creating it in the pool only if an identical node does not exist yet.
+// The hash is built from the hashes of the children rather than their addresses, so it is the same from one run to the next.
+const expression_node * make_node(expression_pool & pool, node_type type, const expression_node * left, const expression_node * right, double value, int order, int symbol){
+	expression_node candidate;
+	candidate.type=type;
+	candidate.value=(value==0.0)?0.0:value; // Fold -0.0 into 0.0 so that both share one node.
+	candidate.order=order;
+	candidate.symbol=symbol;
+	candidate.name=(type==VARIABLE)?&pool.symbols[symbol]:nullptr;
+	candidate.left=left;
+	candidate.right=right;
+	uint64_t bits;
+	memcpy(&bits,&candidate.value,sizeof(double));
+	size_t hash=combine_hash((size_t)type,bits);
+	hash=combine_hash(hash,(uint64_t)order);
+	hash=combine_hash(hash,(uint64_t)symbol);
+	hash=combine_hash(hash,(left==nullptr)?0:left->hash);
+	hash=combine_hash(hash,(right==nullptr)?0:right->hash);
+	candidate.hash=hash;
+	node_index::iterator found=pool.index.find(&candidate);
+	if (found!=pool.index.end()) // If this node already exists...
+		return *found; // ...share it.
+	candidate.id=pool.index.size();
+	expression_node * node=new (arena_allocate(pool.memory, sizeof(expression_node), alignof(expression_node))) expression_node(candidate);
+	pool.index.insert(node);
+	return node;
+}
+
+
+// FUNCTION - Make Constant
+
+const expression_node * make_constant(expression_pool & pool, double value){
+	return make_node(pool, CONSTANT, nullptr, nullptr, value, 0, 0);
+}
+
+
+// FUNCTION - Make Variable
+
+// Returns the node for derivative 'order' of symbol 'symbol': x (order 0), x' (order 1), x'' (order 2), etc.
+const expression_node * make_variable(expression_pool & pool, int symbol, int order){
+	return make_node(pool, VARIABLE, nullptr, nullptr, 0.0, order, symbol);
+}
+
+
+// FUNCTION - Intern Symbol
+
+// Returns the id of the symbol called 'name', adding it to the pool if it is new.
+int intern_symbol(expression_pool & pool, const string & name){
+	unordered_map<string_view, int>::iterator found=pool.symbol_ids.find(name);
+	if (found!=pool.symbol_ids.end())
+		return found->second;
+	pool.symbols.push_back(name);
+	pool.symbol_ids[pool.symbols.back()]=pool.symbols.size()-1;
+	return pool.symbols.size()-1;
+}
+
+
+// FUNCTION - Make Time
+
+const expression_node * make_time(expression_pool & pool){
+	return make_node(pool, TIME, nullptr, nullptr, 0.0, 0, 0);
+}
+
+
+// FUNCTION - Is Constant
+
+// Returns true if node is the constant 'value'.
+bool is_constant(const expression_node * node, double value){
+	return (node->type==CONSTANT)&&(node->value==value);
+}
+
+
+// FUNCTION - Make Binary
+
+// Returns node for 'left' 'type' 'right', dropping terms that are added/subtracted zeros or multiplied/divided ones, as well
+// as products with a zero factor. This does the job that the clean up functions do for strings, but while the node is built.
+const expression_node * make_binary(expression_pool & pool, node_type type, const expression_node * left, const expression_node * right){
+	if (type==ADD){
+		if (is_constant(left,0))
+			return right;
+		if (is_constant(right,0))
+			return left;
+	}
+	if (type==SUBTRACT){
+		if (is_constant(right,0))
+			return left;
+		if (is_constant(left,0))
+			return make_unary(pool, NEGATE, right);
+	}
+	if (type==MULTIPLY){
+		if (is_constant(left,0)||is_constant(right,0))
+			return make_constant(pool, 0);
+		if (is_constant(left,1))
+			return right;
+		if (is_constant(right,1))
+			return left;
+	}
+	if (type==DIVIDE){
+		if (is_constant(left,0))
+			return make_constant(pool, 0);
+		if (is_constant(right,1))
+			return left;
+	}
+	if (type==POWER){
+		if (is_constant(right,1))
+			return left;
+		if (is_constant(right,0))
+			return make_constant(pool, 1);
+	}
+	return make_node(pool, type, left, right, 0.0, 0, 0);
+}
+
+
+// FUNCTION - Make Unary
+
+// Returns node for negation or an elementary function applied to 'argument'.
+const expression_node * make_unary(expression_pool & pool, node_type type, const expression_node * argument){
+	if (type==NEGATE){
+		if (argument->type==NEGATE) // -(-a) is a
+			return argument->left;
+		if (argument->type==CONSTANT)
+			return make_constant(pool, -argument->value);
+	}
+	return make_node(pool, type, argument, nullptr, 0.0, 0, 0);
+}
+
+
+// FUNCTION - Parse Primary
+
+// Parses a number, a bracketed expression, a function such as exp(...) or pow(...,...), a symbol such as x or x''', or
+// t. Symbols must already be interned in the pool (x always is).
+const expression_node * parse_primary(parser & state, expression_pool & pool){
+	token current=state.current;
+	if (current.type==NUMBER_TOKEN){
+		advance(state);
+		return make_constant(pool, current.value);
+	}
+	if (is_operator(current,'(')){
+		advance(state);
+		const expression_node * inside=parse_binary(state, pool, 1);
+		if (inside==nullptr)
+			return nullptr;
+		if (!is_operator(state.current,')'))
+			return parse_fail(state, "expected ')', found "+token_description(state.current));
+		advance(state);
+		return inside;
+	}
+	if (current.type==INVALID_TOKEN)
+		return parse_fail(state, isdigit((unsigned char)current.text[0])?"number is out of range":"unexpected character "+token_description(current));
+	if (current.type!=NAME_TOKEN)
+		return parse_fail(state, "expected an expression, found "+token_description(current));
+	advance(state);
+
+	// CASE 1: a function of one or two bracketed arguments
+	if (is_operator(state.current,'(')&&(current.order==0)){
+		node_type type;
+		if (current.text=="exp")
+			type=EXPONENTIAL;
+		else if (current.text=="log")
+			type=LOGARITHM;
+		else if (current.text=="sin")
+			type=SINE;
+		else if (current.text=="cos")
+			type=COSINE;
+		else if (current.text=="tan")
+			type=TANGENT;
+		else if (current.text=="pow")
+			type=POWER;
+		else {
+			state.current=current;
+			return parse_fail(state, "unknown function "+token_description(current));
+		}
+		advance(state);
+		const expression_node * argument=parse_binary(state, pool, 1);
+		const expression_node * exponent=nullptr;
+		if ((argument!=nullptr)&&(type==POWER)){ // pow takes a second argument after a comma.
+			if (!is_operator(state.current,','))
+				return parse_fail(state, "expected ',', found "+token_description(state.current));
+			advance(state);
+			exponent=parse_binary(state, pool, 1);
+			if (exponent==nullptr)
+				return nullptr;
+		}
+		if (argument==nullptr)
+			return nullptr;
+		if (!is_operator(state.current,')'))
+			return parse_fail(state, "expected ')', found "+token_description(state.current));
+		advance(state);
+		return (type==POWER)?make_node(pool, POWER, argument, exponent, 0.0, 0, 0):make_unary(pool, type, argument);
+	}
+
+	// CASE 2: a symbol such as x, or a derivative of one such as x'''. The order is the number of apostrophes, so it has no
+	// upper limit, and the symbol is found with one lookup.
+	unordered_map<string_view, int>::iterator symbol=pool.symbol_ids.find(current.text);
+	if (symbol!=pool.symbol_ids.end())
+		return make_variable(pool, symbol->second, current.order);
+
+	// CASE 3: t
+	if ((current.text=="t")&&(current.order==0))
+		return make_time(pool);
+
+	state.current=current;
+	return parse_fail(state, "unknown symbol "+token_description(current));
+}
+
+
+// FUNCTION - Parse Unary
+
+// Parses a primary expression preceded by any number of minus signs. A minus sign binds more tightly than * and /, so
+// -x*t is (-x)*t.
+const expression_node * parse_unary(parser & state, expression_pool & pool){
+	if (is_operator(state.current,'-')){
+		advance(state);
+		const expression_node * argument=parse_unary(state, pool);
+		return (argument==nullptr)?nullptr:make_unary(pool, NEGATE, argument);
+	}
+	return parse_primary(state, pool);
+}
+
+
+// FUNCTION - Parse Binary
+
+// Parses a chain of operands joined by operators that bind at least as tightly as 'lowest', by precedence climbing:
+// each operand is parsed together with every operator after it that binds more tightly than the one before it. All
+// operators are left associative, so a-b-c is (a-b)-c and a/b*c is (a/b)*c.
+const expression_node * parse_binary(parser & state, expression_pool & pool, int lowest){
+	const expression_node * left=parse_unary(state, pool);
+	int precedence;
+	while ((left!=nullptr)&&((precedence=operator_precedence(state.current))>=lowest)){ // While the next operator binds tightly enough...
+		char symbol=state.current.text[0];
+		advance(state);
+		const expression_node * right=parse_binary(state, pool, precedence+1);
+		if (right==nullptr)
+			return nullptr;
+		node_type type=(symbol=='+')?ADD:(symbol=='-')?SUBTRACT:(symbol=='*')?MULTIPLY:DIVIDE;
+		left=make_node(pool, type, left, right, 0.0, 0, 0);
+	}
+	return left;
+}
+
+
+// FUNCTION - Parse Expression
+
+// Parses a string into an expression DAG in one pass from left to right, without copying any part of it. Returns null
+// if some part of the string cannot be understood, and says where in 'error'.
+const expression_node * parse_expression(string_view str, expression_pool & pool, parse_error & error){
+	parser state;
+	state.source=str;
+	advance(state);
+	const expression_node * expression=parse_binary(state, pool, 1);
+	if ((expression!=nullptr)&&(state.current.type!=END_TOKEN))
+		expression=parse_fail(state, "unexpected "+token_description(state.current));
+	error=state.error;
+	return expression;
+}
+
+
+// FUNCTION - Parse Expression
+
+// Parses a string into an expression DAG, or returns null if it cannot be parsed, for callers that do not report why.
+const expression_node * parse_expression(string_view str, expression_pool & pool){
+	parse_error error;
+	return parse_expression(str, pool, error);
+}
+
+
+// FUNCTION - Number To String
+
+// Writes a constant without exponent notation, and without trailing zeros.
+string number_to_string(double value){
+	ostringstream out;
+	out<<fixed<<setprecision(15)<<value;
+	string str=out.str();
+	if (str.find('.')!=string::npos){
+		str.erase(str.find_last_not_of('0')+1);
+		if (str[str.length()-1]=='.')
+			str.erase(str.length()-1);
+	}
+	return str;
+}
+
+
+// FUNCTION - Operand To String
+
+// Writes an operand of a larger expression, enclosing it in brackets if 'brackets' is true. Negative terms are always
+// enclosed, so that a - sign never directly follows another +-*/ symbol.
+string operand_to_string(const expression_node * node, bool brackets){
+	if ((node->type==NEGATE)||((node->type==CONSTANT)&&(node->value<0)))
+		brackets=true;
+	if (brackets)
+		return '('+expression_to_string(node)+')';
+	return expression_to_string(node);
+}
+
+
+// FUNCTION - Expression To String
+
+// Writes expression DAG as a string, in the same syntax that is accepted as input.
+string expression_to_string(const expression_node * node){
+	const expression_node * l=node->left;
+	const expression_node * r=node->right;
+	switch (node->type){
+		case CONSTANT:
+			return number_to_string(node->value);
+		case VARIABLE:
+			return *node->name+string(node->order,'\'');
+		case TIME:
+			return "t";
+		case ADD:
+			if (r->type==NEGATE) // a+(-b) is written as a-b
+				return operand_to_string(l,false)+'-'+operand_to_string(r->left,(r->left->type==ADD)||(r->left->type==SUBTRACT));
+			if ((r->type==CONSTANT)&&(r->value<0))
+				return operand_to_string(l,false)+'-'+number_to_string(-r->value);
+			return operand_to_string(l,false)+'+'+operand_to_string(r,false);
+		case SUBTRACT:
+			return operand_to_string(l,false)+'-'+operand_to_string(r,(r->type==ADD)||(r->type==SUBTRACT));
+		case MULTIPLY:
+			return operand_to_string(l,(l->type==ADD)||(l->type==SUBTRACT)||(l->type==DIVIDE))+'*'+operand_to_string(r,(r->type==ADD)||(r->type==SUBTRACT));
+		case DIVIDE:
+			return operand_to_string(l,(l->type==ADD)||(l->type==SUBTRACT)||(l->type==DIVIDE))+'/'+operand_to_string(r,(r->type==ADD)||(r->type==SUBTRACT)||(r->type==MULTIPLY)||(r->type==DIVIDE));
+		case NEGATE:
+			return '-'+operand_to_string(l,(l->type==ADD)||(l->type==SUBTRACT)||(l->type==MULTIPLY)||(l->type==DIVIDE));
+		case EXPONENTIAL:
+			return "exp("+expression_to_string(l)+')';
+		case LOGARITHM:
+			return "log("+expression_to_string(l)+')';
+		case POWER:
+			return "pow("+expression_to_string(l)+','+expression_to_string(r)+')';
+		case SINE:
+			return "sin("+expression_to_string(l)+')';
+		case COSINE:
+			return "cos("+expression_to_string(l)+')';
+		case TANGENT:
+			return "tan("+expression_to_string(l)+')';
+	}
+	return "error";
+}
+
+// END EXPRESSION FUNCTIONS
+
+
+
+// START DERIVATIVE FUNCTIONS
+
+// FUNCTION - Differentiate
+
+// Return derivative of expression. 'cache' maps each node differentiated so far to its derivative, so a subtree that is
+// shared by several parts of the DAG, or that was already differentiated for a lower order, is differentiated once, and
+// its derivative is shared in the same way.
+const expression_node * differentiate(const expression_node * node, expression_pool & pool, derivative_cache & cache){
+	node_map::iterator found=cache.derivatives.find(node);
+	if (found!=cache.derivatives.end()){ // If this subtree has already been differentiated...
+		cache.hits++;
+		return found->second;
+	}
+	cache.misses++;
+
+	const expression_node * l=node->left;
+	const expression_node * r=node->right;
+	const expression_node * derivative=nullptr;
+	switch (node->type){
+		case CONSTANT: // Derivative of a constant is zero.
+			derivative=make_constant(pool, 0);
+			break;
+		case VARIABLE: // Derivative of i-th derivative of x is (i+1)-th derivative of x.
+			derivative=make_variable(pool, node->symbol, node->order+1);
+			break;
+		case TIME:
+			derivative=make_constant(pool, 1);
+			break;
+		case ADD:
+		case SUBTRACT:
+			derivative=make_binary(pool, node->type, differentiate(l, pool, cache), differentiate(r, pool, cache));
+			break;
+		case MULTIPLY:
+			derivative=product_rule(l, r, pool, cache);
+			break;
+		case DIVIDE:
+			derivative=quotient_rule(l, r, pool, cache);
+			break;
+		case NEGATE:
+			derivative=make_unary(pool, NEGATE, differentiate(l, pool, cache));
+			break;
+		case EXPONENTIAL: // Derivative is argument' * exp(argument)
+			derivative=make_binary(pool, MULTIPLY, differentiate(l, pool, cache), node);
+			break;
+		case LOGARITHM: // Derivative is argument' / argument
+			derivative=make_binary(pool, DIVIDE, differentiate(l, pool, cache), l);
+			break;
+		case POWER:
+			if (r->type==CONSTANT){ // If exponent is a number...
+				if (r->value==2) // ...and if it is 2...
+					derivative=make_binary(pool, MULTIPLY, make_binary(pool, MULTIPLY, make_constant(pool, 2), differentiate(l, pool, cache)), l);
+				else
+					derivative=make_binary(pool, MULTIPLY, make_binary(pool, MULTIPLY, r, differentiate(l, pool, cache)), make_binary(pool, POWER, l, make_constant(pool, r->value-1)));
+			}
+			else // pow(u,v)' = pow(u,v) * (v'*log(u) + v*u'/u)
+				derivative=make_binary(pool, MULTIPLY, node, make_binary(pool, ADD, make_binary(pool, MULTIPLY, differentiate(r, pool, cache), make_unary(pool, LOGARITHM, l)), make_binary(pool, DIVIDE, make_binary(pool, MULTIPLY, r, differentiate(l, pool, cache)), l)));
+			break;
+		case SINE:
+			derivative=make_binary(pool, MULTIPLY, differentiate(l, pool, cache), make_unary(pool, COSINE, l));
+			break;
+		case COSINE:
+			derivative=make_unary(pool, NEGATE, make_binary(pool, MULTIPLY, differentiate(l, pool, cache), make_unary(pool, SINE, l)));
+			break;
+		case TANGENT: // Derivative is argument' / cos(argument)^2
+			derivative=make_binary(pool, DIVIDE, differentiate(l, pool, cache), make_binary(pool, POWER, make_unary(pool, COSINE, l), make_constant(pool, 2)));
+			break;
+	}
+	cache.derivatives[node]=derivative;
+	return derivative;
+}
+
+
+// FUNCTION - Product Rule
+
+const expression_node * product_rule(const expression_node * term_one, const expression_node * term_two, expression_pool & pool, derivative_cache & cache){
+	const expression_node * d1=differentiate(term_one, pool, cache);
+	const expression_node * d2=differentiate(term_two, pool, cache);
+	return make_binary(pool, ADD, make_binary(pool, MULTIPLY, d1, term_two), make_binary(pool, MULTIPLY, term_one, d2)); // Zero terms are dropped by make_binary.
+}
+
+
+// FUNCTION - Quotient rule
+
+const expression_node * quotient_rule(const expression_node * term_one, const expression_node * term_two, expression_pool & pool, derivative_cache & cache){
+	const expression_node * d1=differentiate(term_one, pool, cache);
+	const expression_node * d2=differentiate(term_two, pool, cache);
+	if (is_constant(d2,0)) // If denominator is constant...
+		return make_binary(pool, DIVIDE, d1, term_two);
+	const expression_node * numerator=make_binary(pool, SUBTRACT, make_binary(pool, MULTIPLY, d1, term_two), make_binary(pool, MULTIPLY, term_one, d2));
+	return make_binary(pool, DIVIDE, numerator, make_binary(pool, POWER, term_two, make_constant(pool, 2)));
+}
+
+
+// FUNCTION - Output Derivative
+
+// Performs Derivative and Simplify operations on an expression DAG. The derivative shares all unchanged subtrees with the
+// input expression, and the cache carries derivatives and simplified forms over from earlier orders. A polynomial in x,
+// its derivatives and t is differentiated through its polynomial form instead, and so are all of its derivatives.
+const expression_node * output_derivative(const expression_node * expression, expression_pool & pool, derivative_cache & cache){
+	int form=polynomial_form(expression, cache);
+	if (form>=0) // A polynomial never takes the general path.
+		return differentiate_polynomial(form, pool, cache);
+	return simplify(differentiate(expression, pool, cache), pool, cache.simplified);
+}
+
+
+// FUNCTION - Start Sequence
+
+// Parses and simplifies 'function' as x', the first term of 'sequence'. No higher derivative is made until it is asked
+// for. Returns false if 'function' cannot be parsed, and says why in 'error'.
+bool start_sequence(derivative_sequence & sequence, const string & function, parse_error & error){
+	const expression_node * expression=parse_expression(function, sequence.pool, error);
+	if (expression==nullptr)
+		return false;
+	sequence.terms.assign(1, simplify_expression(expression, sequence.pool));
+	return true;
+}
+
+
+// FUNCTION - Sequence Term
+
+// Returns term 'index' of 'sequence' (derivative index+1 of x), first making every order up to it that has not been
+// made yet, each from the one before.
+const expression_node * sequence_term(derivative_sequence & sequence, int index){
+	while (sequence.terms.size()<=index) // For each order not made yet...
+		sequence.terms.push_back(traced_derivative(sequence.terms.back(), sequence.pool, sequence.cache, sequence.terms.size()+1));
+	return sequence.terms[index];
+}
+
+// END DERIVATIVE FUNCTIONS
+
+
+
+// START SIMPLIFY FUNCTIONS
+
+// These functions put an expression DAG into a canonical, simplified form. A sum is flattened into a constant plus a
+// list of (coefficient, term) pairs, and a product into a coefficient times a list of (base, exponent) pairs. Like terms
+// and like bases are then merged, zeros and ones are dropped, constants are folded, and the remaining terms and factors
+// are sorted, so that equal sums or products written in different orders become the same node. Each node of the DAG is
+// simplified once.
+
+
+// FUNCTION - Node Less
+
+// Order in which terms of a sum and factors of a product are written: x, x', x'', ... (and then other symbols, in the
+// order of their ids), then t, then other expressions by
+// kind of node, and then by their operands. The order depends only on the structure of the expressions, not on when
+// their nodes were created, so an expression simplifies to the same form whatever else is in the pool.
+bool node_less(const expression_node * a, const expression_node * b){
+	if (a==b) // Nodes are hash-consed, so equal expressions are the same node.
+		return false;
+	int rank_a=(a->type==VARIABLE)?0:((a->type==TIME)?1:2);
+	int rank_b=(b->type==VARIABLE)?0:((b->type==TIME)?1:2);
+	if (rank_a!=rank_b)
+		return rank_a<rank_b;
+	if (rank_a==0)
+		return (a->symbol!=b->symbol)?(a->symbol<b->symbol):(a->order<b->order);
+	if (a->type!=b->type)
+		return a->type<b->type;
+	if (a->type==CONSTANT)
+		return a->value<b->value;
+	if (a->left!=b->left)
+		return node_less(a->left, b->left);
+	return (a->right!=nullptr)&&node_less(a->right, b->right);
+}
+
+bool term_less(const pair<const expression_node *, double> & a, const pair<const expression_node *, double> & b){
+	return node_less(a.first, b.first);
+}
+
+
+// FUNCTION - Collect Terms
+
+// Adds the terms of 'node', multiplied by 'factor', to 'terms' and 'constant'. 'positions' maps each term already in
+// 'terms' to its position, so like terms are merged by adding their coefficients.
+void collect_terms(const expression_node * node, double factor, part_list & terms, position_map & positions, double & constant){
+	if (node->type==ADD){
+		collect_terms(node->left, factor, terms, positions, constant);
+		collect_terms(node->right, factor, terms, positions, constant);
+		return;
+	}
+	if (node->type==SUBTRACT){
+		collect_terms(node->left, factor, terms, positions, constant);
+		collect_terms(node->right, -factor, terms, positions, constant);
+		return;
+	}
+	if (node->type==NEGATE){
+		collect_terms(node->left, -factor, terms, positions, constant);
+		return;
+	}
+	if (node->type==CONSTANT){
+		constant+=factor*node->value;
+		return;
+	}
+	if ((node->type==MULTIPLY)&&(node->left->type==CONSTANT)){ // Simplified products keep their coefficient on the left.
+		if ((node->right->type==ADD)||(node->right->type==SUBTRACT)||(node->right->type==NEGATE)){ // c*(a+b) is c*a+c*b
+			collect_terms(node->right, factor*node->left->value, terms, positions, constant);
+			return;
+		}
+		factor*=node->left->value;
+		node=node->right;
+	}
+	position_map::iterator found=positions.find(node);
+	if (found!=positions.end())
+		terms[found->second].second+=factor;
+	else {
+		positions[node]=terms.size();
+		terms.push_back(make_pair(node, factor));
+	}
+}
+
+
+// FUNCTION - Collect Factors
+
+// Adds the factors of 'node', raised to 'exponent', to 'factors' and 'coefficient'. Products, quotients, negations and
+// powers are only split up when 'exponent' is an integer, since for example pow(x*y,0.5) is not pow(x,0.5)*pow(y,0.5)
+// when x and y are negative.
+void collect_factors(const expression_node * node, double exponent, part_list & factors, position_map & positions, double & coefficient){
+	bool integer=(exponent==floor(exponent));
+	if (node->type==CONSTANT){
+		coefficient*=pow(node->value, exponent);
+		return;
+	}
+	if (integer&&(node->type==MULTIPLY)){
+		collect_factors(node->left, exponent, factors, positions, coefficient);
+		collect_factors(node->right, exponent, factors, positions, coefficient);
+		return;
+	}
+	if (integer&&(node->type==DIVIDE)){
+		collect_factors(node->left, exponent, factors, positions, coefficient);
+		collect_factors(node->right, -exponent, factors, positions, coefficient);
+		return;
+	}
+	if (integer&&(node->type==NEGATE)){
+		coefficient*=pow(-1.0, exponent);
+		collect_factors(node->left, exponent, factors, positions, coefficient);
+		return;
+	}
+	if (integer&&(node->type==POWER)&&(node->right->type==CONSTANT)&&(node->right->value==floor(node->right->value))){
+		collect_factors(node->left, exponent*node->right->value, factors, positions, coefficient);
+		return;
+	}
+	if ((node->type==POWER)&&(node->right->type==CONSTANT)&&integer){ // pow(u,c)^n = pow(u,c*n) for integer n
+		exponent*=node->right->value;
+		node=node->left;
+	}
+	position_map::iterator found=positions.find(node);
+	if (found!=positions.end())
+		factors[found->second].second+=exponent;
+	else {
+		positions[node]=factors.size();
+		factors.push_back(make_pair(node, exponent));
+	}
+}
+
+
+// FUNCTION - Build Product
+
+// Writes coefficient * (numerator factors) / (denominator factors), with factors in canonical order.
+const expression_node * build_product(expression_pool & pool, double coefficient, part_list & factors){
+	if (coefficient==0)
+		return make_constant(pool, 0);
+	sort(factors.begin(), factors.end(), term_less);
+	const expression_node * numerator=nullptr;
+	const expression_node * denominator=nullptr;
+	for (int i=0; i<factors.size(); i++){ // For each base...
+		double exponent=fabs(factors[i].second);
+		if (exponent==0) // x^a*x^(-a) cancels.
+			continue;
+		const expression_node * factor=(exponent==1)?factors[i].first:make_node(pool, POWER, factors[i].first, make_constant(pool, exponent), 0.0, 0, 0);
+		const expression_node * & side=(factors[i].second>0)?numerator:denominator;
+		side=(side==nullptr)?factor:make_node(pool, MULTIPLY, side, factor, 0.0, 0, 0);
+	}
+	const expression_node * product;
+	if (numerator==nullptr&&denominator==nullptr)
+		return make_constant(pool, coefficient);
+	if (denominator==nullptr)
+		product=numerator;
+	else
+		product=make_node(pool, DIVIDE, (numerator==nullptr)?make_constant(pool, 1):numerator, denominator, 0.0, 0, 0);
+	if (coefficient==1)
+		return product;
+	if (coefficient==-1)
+		return make_node(pool, NEGATE, product, nullptr, 0.0, 0, 0);
+	if ((numerator==nullptr)&&(product->type==DIVIDE)) // c*(1/d) is written c/d
+		return make_node(pool, DIVIDE, make_constant(pool, coefficient), denominator, 0.0, 0, 0);
+	return make_node(pool, MULTIPLY, make_constant(pool, coefficient), product, 0.0, 0, 0);
+}
+
+
+// FUNCTION - Build Sum
+
+// Writes the terms (each with its coefficient) followed by the constant, with terms in canonical order. Terms with negative
+// coefficients are subtracted.
+const expression_node * build_sum(expression_pool & pool, part_list & terms, double constant){
+	sort(terms.begin(), terms.end(), term_less);
+	const expression_node * sum=nullptr;
+	for (int i=0; i<terms.size(); i++){ // For each term...
+		double coefficient=terms[i].second;
+		if (coefficient==0) // Like terms cancelled.
+			continue;
+		arena_scope scope(pool.scratch);
+		part_list factors(1, make_pair(terms[i].first, 1.0), &pool.scratch);
+		if (sum==nullptr)
+			sum=build_product(pool, coefficient, factors);
+		else
+			sum=make_node(pool, (coefficient>0)?ADD:SUBTRACT, sum, build_product(pool, fabs(coefficient), factors), 0.0, 0, 0);
+	}
+	if (sum==nullptr)
+		return make_constant(pool, constant);
+	if (constant!=0)
+		sum=make_node(pool, (constant>0)?ADD:SUBTRACT, sum, make_constant(pool, fabs(constant)), 0.0, 0, 0);
+	return sum;
+}
+
+
+// FUNCTION - Fold Function
+
+// Returns value of an elementary function of a constant argument.
+double fold_function(node_type type, double a){
+	switch (type){
+		case EXPONENTIAL: return exp(a);
+		case LOGARITHM: return log(a);
+		case SINE: return sin(a);
+		case COSINE: return cos(a);
+		case TANGENT: return tan(a);
+		default: return a;
+	}
+}
+
+
+// FUNCTION - Simplify
+
+// Returns the simplified form of 'node'. 'simplified' maps each node simplified so far to its simplified form. The parts
+// of a sum or product are collected in pool.scratch, which is released when the call returns. Each call releases back
+// to where it started, after anything its caller had collected, so the releases nest like the calls.
+const expression_node * simplify(const expression_node * node, expression_pool & pool, node_map & simplified){
+	node_map::iterator found=simplified.find(node);
+	if (found!=simplified.end())
+		return found->second;
+
+	const expression_node * result=node;
+	double constant=0, coefficient=1;
+	arena_scope scope(pool.scratch);
+	part_list parts(&pool.scratch);
+	position_map positions(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &pool.scratch);
+	switch (node->type){
+		case CONSTANT:
+		case VARIABLE:
+		case TIME:
+			break;
+		case ADD:
+		case SUBTRACT:
+		case NEGATE:
+			collect_terms(simplify(node->left, pool, simplified), (node->type==NEGATE)?-1:1, parts, positions, constant);
+			if (node->type!=NEGATE)
+				collect_terms(simplify(node->right, pool, simplified), (node->type==ADD)?1:-1, parts, positions, constant);
+			result=build_sum(pool, parts, constant);
+			break;
+		case MULTIPLY:
+		case DIVIDE:
+			collect_factors(simplify(node->left, pool, simplified), 1, parts, positions, coefficient);
+			collect_factors(simplify(node->right, pool, simplified), (node->type==MULTIPLY)?1:-1, parts, positions, coefficient);
+			result=build_product(pool, coefficient, parts);
+			break;
+		case POWER:
+			result=simplify(node->right, pool, simplified); // Exponent
+			if (result->type==CONSTANT){ // A power with a constant exponent is a product with one factor.
+				collect_factors(simplify(node->left, pool, simplified), result->value, parts, positions, coefficient);
+				result=build_product(pool, coefficient, parts);
+			}
+			else
+				result=make_binary(pool, POWER, simplify(node->left, pool, simplified), result);
+			break;
+		default: // Elementary function
+			result=simplify(node->left, pool, simplified);
+			if (result->type==CONSTANT)
+				result=make_constant(pool, fold_function(node->type, result->value));
+			else
+				result=make_unary(pool, node->type, result);
+			break;
+	}
+	simplified[node]=result;
+	simplified[result]=result; // The simplified form is already simplified.
+	return result;
+}
+
+
+// FUNCTION - Simplify Expression
+
+// Simplifies an expression DAG.
+const expression_node * simplify_expression(const expression_node * expression, expression_pool & pool){
+	arena memory; // storage for 'simplified', freed on return
+	node_map simplified(0, hash<const expression_node *>(), equal_to<const expression_node *>(), &memory);
+	return simplify(expression, pool, simplified);
+}
+
+
+// FUNCTION - Count Nodes
+
+// Returns the number of distinct nodes in an expression DAG.
+int count_nodes(const expression_node * node, unordered_set<const expression_node *> & visited){
+	if ((node==nullptr)||!visited.insert(node).second)
+		return 0;
+	return 1+count_nodes(node->left, visited)+count_nodes(node->right, visited);
+}
+
+// END SIMPLIFY FUNCTIONS
+
+
+
+// START POLYNOMIAL FUNCTIONS
+
+// When an expression is a polynomial in t, x, x', x'', ..., output_derivative takes it through a sparse_polynomial
+// instead of the product and power rules of differentiate. The derivative of a monomial is a short list of monomials,
+// so a derivative of any order is found in time linear in the number of monomials, and it is written back as an
+// expression already in the canonical form that simplify would give it, with products of sums multiplied out.
+
+
+// FUNCTION - Power Less
+
+// Order of the powers within a monomial: by symbol (t first), and then by derivative order.
+bool power_less(const polynomial_power & a, const polynomial_power & b){
+	return (a.symbol!=b.symbol)?(a.symbol<b.symbol):(a.order<b.order);
+}
+
+
+// FUNCTION - Monomial Less
+
+// Order of the monomials within a polynomial: by their lists of powers, compared element by element.
+bool monomial_less(const monomial & a, const monomial & b){
+	for (int i=0; (i<a.powers.size())&&(i<b.powers.size()); i++){ // For each power the two have in common...
+		const polynomial_power & p=a.powers[i];
+		const polynomial_power & q=b.powers[i];
+		if ((p.symbol!=q.symbol)||(p.order!=q.order))
+			return power_less(p, q);
+		if (p.power!=q.power)
+			return p.power<q.power;
+	}
+	return a.powers.size()<b.powers.size();
+}
+
+
+// FUNCTION - Same Powers
+
+// Returns true if two monomials are alike, differing at most in their coefficients.
+bool same_powers(const monomial & a, const monomial & b){
+	if (a.powers.size()!=b.powers.size())
+		return false;
+	for (int i=0; i<a.powers.size(); i++)
+		if ((a.powers[i].symbol!=b.powers[i].symbol)||(a.powers[i].order!=b.powers[i].order)||(a.powers[i].power!=b.powers[i].power))
+			return false;
+	return true;
+}
+
+
+// FUNCTION - Normalize Polynomial
+
+// Sorts the monomials of 'polynomial', merges like monomials by adding their coefficients, and drops any that cancel.
+void normalize_polynomial(sparse_polynomial & polynomial){
+	monomial_list & terms=polynomial.terms;
+	sort(terms.begin(), terms.end(), monomial_less);
+	int kept=0;
+	for (int i=0; i<terms.size(); i++){ // For each monomial...
+		if ((kept>0)&&same_powers(terms[kept-1], terms[i]))
+			terms[kept-1].coefficient+=terms[i].coefficient;
+		else {
+			if (kept!=i)
+				terms[kept]=move(terms[i]);
+			kept++;
+		}
+	}
+	terms.erase(terms.begin()+kept, terms.end());
+	terms.erase(remove_if(terms.begin(), terms.end(), [](const monomial & term){ return term.coefficient==0; }), terms.end());
+}
+
+
+// FUNCTION - Multiply Power
+
+// Multiplies 'term' by the variable (symbol, order) raised to 'power', keeping its powers sorted.
+void multiply_power(monomial & term, int symbol, int order, int power){
+	polynomial_power factor={symbol, order, power};
+	power_list::iterator position=lower_bound(term.powers.begin(), term.powers.end(), factor, power_less);
+	if ((position!=term.powers.end())&&(position->symbol==symbol)&&(position->order==order))
+		position->power+=power;
+	else
+		term.powers.insert(position, factor);
+}
+
+
+// FUNCTION - Copy Monomial
+
+// Returns a copy of 'term' with the given coefficient, taking its list of powers from 'memory'. (Copying a monomial
+// the usual way would take the list from the arena of the original.)
+monomial copy_monomial(const monomial & term, double coefficient, arena & memory){
+	return monomial{coefficient, power_list(term.powers.begin(), term.powers.end(), arena_allocator<polynomial_power>(&memory))};
+}
+
+
+// FUNCTION - Copy Polynomial
+
+// Returns a copy of 'polynomial' taken entirely from 'memory'.
+sparse_polynomial copy_polynomial(const sparse_polynomial & polynomial, arena & memory){
+	sparse_polynomial copy={monomial_list(&memory)};
+	copy.terms.reserve(polynomial.terms.size());
+	for (int i=0; i<polynomial.terms.size(); i++)
+		copy.terms.push_back(copy_monomial(polynomial.terms[i], polynomial.terms[i].coefficient, memory));
+	return copy;
+}
+
+
+// FUNCTION - Add Polynomials
+
+// Returns a + scale*b, taken from 'memory', merging the two sorted lists of monomials in one pass.
+sparse_polynomial add_polynomials(const sparse_polynomial & a, const sparse_polynomial & b, double scale, arena & memory){
+	sparse_polynomial sum={monomial_list(&memory)};
+	sum.terms.reserve(a.terms.size()+b.terms.size());
+	int i=0, j=0;
+	while ((i<a.terms.size())||(j<b.terms.size())){ // Until both lists are used up...
+		if ((j==b.terms.size())||((i<a.terms.size())&&monomial_less(a.terms[i], b.terms[j]))){
+			sum.terms.push_back(copy_monomial(a.terms[i], a.terms[i].coefficient, memory));
+			i++;
+		}
+		else if ((i==a.terms.size())||monomial_less(b.terms[j], a.terms[i])){
+			sum.terms.push_back(copy_monomial(b.terms[j], scale*b.terms[j].coefficient, memory));
+			j++;
+		}
+		else { // Like monomials
+			double coefficient=a.terms[i].coefficient+scale*b.terms[j].coefficient;
+			if (coefficient!=0)
+				sum.terms.push_back(copy_monomial(a.terms[i], coefficient, memory));
+			i++;
+			j++;
+		}
+	}
+	return sum;
+}
+
+
+// FUNCTION - Multiply Polynomials
+
+// Returns a*b, taken from 'memory', multiplying out every pair of monomials.
+sparse_polynomial multiply_polynomials(const sparse_polynomial & a, const sparse_polynomial & b, arena & memory){
+	sparse_polynomial product={monomial_list(&memory)};
+	product.terms.reserve(a.terms.size()*b.terms.size());
+	for (int i=0; i<a.terms.size(); i++) // For each monomial of a...
+		for (int j=0; j<b.terms.size(); j++){ // ...and each monomial of b.
+			monomial term=copy_monomial(a.terms[i], a.terms[i].coefficient*b.terms[j].coefficient, memory);
+			for (int k=0; k<b.terms[j].powers.size(); k++)
+				multiply_power(term, b.terms[j].powers[k].symbol, b.terms[j].powers[k].order, b.terms[j].powers[k].power);
+			product.terms.push_back(move(term));
+		}
+	normalize_polynomial(product);
+	return product;
+}
+
+
+// FUNCTION - Polynomial Derivative
+
+// Returns the derivative of 'polynomial' with respect to t, taken from 'memory'. Each power v^p of a monomial gives one
+// monomial of the derivative, p*v^(p-1)*v' times the other powers, where t' is 1 and the derivative of x^(k) is x^(k+1).
+sparse_polynomial polynomial_derivative(const sparse_polynomial & polynomial, arena & memory){
+	sparse_polynomial derivative={monomial_list(&memory)};
+	for (int i=0; i<polynomial.terms.size(); i++){ // For each monomial...
+		const monomial & term=polynomial.terms[i];
+		for (int j=0; j<term.powers.size(); j++){ // ...and each of its powers.
+			polynomial_power variable=term.powers[j];
+			monomial part=copy_monomial(term, term.coefficient*variable.power, memory);
+			if (variable.power==1)
+				part.powers.erase(part.powers.begin()+j);
+			else
+				part.powers[j].power--;
+			if (variable.symbol>=0)
+				multiply_power(part, variable.symbol, variable.order+1, 1);
+			derivative.terms.push_back(move(part));
+		}
+	}
+	normalize_polynomial(derivative);
+	return derivative;
+}
+
+
+// FUNCTION - Polynomial Form
+
+// Returns the index in cache.polynomials of the polynomial form of 'node', or -1 if 'node' is not a polynomial in the
+// symbols, their derivatives and t: it may only add, subtract, negate, multiply, divide by a constant, and raise to a
+// constant integer power from 0 to polynomial_power_limit. Each node is converted once, from the forms of its operands.
+// Intermediate polynomials are taken from cache.scratch, and only the form that is kept is copied into cache.memory.
+int polynomial_form(const expression_node * node, derivative_cache & cache){
+	position_map::iterator found=cache.polynomial_forms.find(node);
+	if (found!=cache.polynomial_forms.end())
+		return found->second;
+	bool polynomial=true;
+	int a=-1, b=-1;
+	if ((node->type!=POWER)&&(node->left!=nullptr)) // Operands; an operand that is not a polynomial ends the search.
+		a=polynomial_form(node->left, cache);
+	if ((node->type!=POWER)&&(node->right!=nullptr)&&(a>=0))
+		b=polynomial_form(node->right, cache);
+	arena_scope scope(cache.scratch);
+	sparse_polynomial result={monomial_list(&cache.scratch)};
+	sparse_polynomial zero={monomial_list(&cache.scratch)};
+	power_list powers(&cache.scratch);
+	switch (node->type){
+		case CONSTANT:
+			if (node->value!=0)
+				result.terms.push_back(monomial{node->value, powers});
+			break;
+		case VARIABLE:
+			powers.push_back(polynomial_power{node->symbol, node->order, 1});
+			result.terms.push_back(monomial{1, powers});
+			break;
+		case TIME:
+			powers.push_back(polynomial_power{-1, 0, 1});
+			result.terms.push_back(monomial{1, powers});
+			break;
+		case ADD:
+		case SUBTRACT:
+			polynomial=(b>=0);
+			if (polynomial)
+				result=add_polynomials(cache.polynomials[a], cache.polynomials[b], (node->type==ADD)?1:-1, cache.scratch);
+			break;
+		case NEGATE:
+			polynomial=(a>=0);
+			if (polynomial)
+				result=add_polynomials(zero, cache.polynomials[a], -1, cache.scratch);
+			break;
+		case MULTIPLY:
+			polynomial=(b>=0)&&((long)cache.polynomials[a].terms.size()*cache.polynomials[b].terms.size()<=4L*polynomial_term_limit);
+			if (polynomial)
+				result=multiply_polynomials(cache.polynomials[a], cache.polynomials[b], cache.scratch);
+			break;
+		case DIVIDE: // Only division by a constant other than zero
+			polynomial=(b>=0)&&(cache.polynomials[b].terms.size()==1)&&cache.polynomials[b].terms[0].powers.empty();
+			if (polynomial)
+				result=add_polynomials(zero, cache.polynomials[a], 1/cache.polynomials[b].terms[0].coefficient, cache.scratch);
+			break;
+		case POWER: // Only a constant integer exponent, by repeated squaring
+			polynomial=(node->right->type==CONSTANT)&&(node->right->value==floor(node->right->value))&&(node->right->value>=0)&&(node->right->value<=polynomial_power_limit);
+			if (polynomial)
+				a=polynomial_form(node->left, cache);
+			if (polynomial&&(a>=0)){
+				sparse_polynomial base=copy_polynomial(cache.polynomials[a], cache.scratch);
+				result.terms.push_back(monomial{1, powers});
+				for (int n=node->right->value; polynomial&&(n>0); n>>=1){ // For each bit of the exponent...
+					if (n&1)
+						result=multiply_polynomials(result, base, cache.scratch);
+					if (n>1)
+						base=multiply_polynomials(base, base, cache.scratch);
+					polynomial=(result.terms.size()<=polynomial_term_limit)&&(base.terms.size()<=polynomial_term_limit);
+				}
+			}
+			polynomial=polynomial&&(a>=0);
+			break;
+		default: // Elementary functions
+			polynomial=false;
+			break;
+	}
+	int index=-1;
+	if (polynomial&&(result.terms.size()<=polynomial_term_limit)){
+		cache.polynomials.push_back(copy_polynomial(result, cache.memory));
+		cache.polynomial_derivatives.push_back(nullptr);
+		index=cache.polynomials.size()-1;
+	}
+	cache.polynomial_forms[node]=index;
+	return index;
+}
+
+
+// FUNCTION - Polynomial Expression
+
+// Writes 'polynomial' as an expression, with build_product and build_sum, so that it has the canonical form of
+// simplify.
+const expression_node * polynomial_expression(const sparse_polynomial & polynomial, expression_pool & pool){
+	arena_scope scope(pool.scratch);
+	part_list terms(&pool.scratch);
+	double constant=0;
+	for (int i=0; i<polynomial.terms.size(); i++){ // For each monomial...
+		const monomial & term=polynomial.terms[i];
+		if (term.powers.empty()){
+			constant+=term.coefficient;
+			continue;
+		}
+		part_list factors(&pool.scratch);
+		for (int j=0; j<term.powers.size(); j++){ // For each power...
+			const polynomial_power & variable=term.powers[j];
+			factors.push_back(make_pair((variable.symbol<0)?make_time(pool):make_variable(pool, variable.symbol, variable.order), double(variable.power)));
+		}
+		terms.push_back(make_pair(build_product(pool, 1, factors), term.coefficient));
+	}
+	return build_sum(pool, terms, constant);
+}
+
+
+// FUNCTION - Differentiate Polynomial
+
+// Returns the derivative of the polynomial cache.polynomials[form] as an expression. The result is remembered as
+// already simplified, and with its polynomial form, so that the next derivative starts from the polynomial directly.
+// Results are kept apart from cache.derivatives, which may hold a derivative of the same node from the general path.
+const expression_node * differentiate_polynomial(int form, expression_pool & pool, derivative_cache & cache){
+	if (cache.polynomial_derivatives[form]!=nullptr){ // If this polynomial has already been differentiated...
+		cache.hits++;
+		return cache.polynomial_derivatives[form];
+	}
+	cache.misses++;
+	arena_scope scope(cache.scratch);
+	sparse_polynomial derivative=polynomial_derivative(cache.polynomials[form], cache.scratch);
+	const expression_node * node=polynomial_expression(derivative, pool);
+	cache.polynomial_derivatives[form]=node;
+	cache.simplified.emplace(node, node);
+	if ((derivative.terms.size()<=polynomial_term_limit)&&(cache.polynomial_forms.find(node)==cache.polynomial_forms.end())){
+		cache.polynomials.push_back(copy_polynomial(derivative, cache.memory));
+		cache.polynomial_derivatives.push_back(nullptr);
+		cache.polynomial_forms[node]=cache.polynomials.size()-1;
+	}
+	return node;
+}
+
+// END POLYNOMIAL FUNCTIONS
+
+
+
+// START DOUBLE-DOUBLE FUNCTIONS
+
+// In this section, each operation on double_double finds the rounding error of its leading double operation exactly,
+// and carries it in lo. The error-free transformations two_sum and two_product follow Dekker and Knuth; the elementary
+// functions reduce their argument, sum a short series, and undo the reduction. Infinities and NaNs are not handled
+// specially, and give NaN where a double result would be infinite.
+
+const double_double dd_ln2(0.6931471805599453, 2.3190468138462996e-17); // log(2)
+const double_double dd_pi_2(1.5707963267948966, 6.123233995736766e-17); // pi/2
+const double dd_epsilon=4.93038065763132e-32; // 2^-104, relative size of the last bit of a double_double
+
+
+// FUNCTION - Two Sum
+
+// Returns a+b rounded to double, and sets 'error' to the exact rounding error, so that a+b = result+error.
+double two_sum(double a, double b, double & error){
+	double s=a+b;
+	double bb=s-a;
+	error=(a-(s-bb))+(b-bb);
+	return s;
+}
+
+
+// FUNCTION - Quick Two Sum
+
+// Same as two_sum, but only exact if |a| >= |b|.
+double quick_two_sum(double a, double b, double & error){
+	double s=a+b;
+	error=b-(s-a);
+	return s;
+}
+
+
+// FUNCTION - Two Product
+
+// Returns a*b rounded to double, and sets 'error' to the exact rounding error. A fused multiply-add gives the error
+// directly; without one, a and b are split into halves whose products are exact.
+double two_product(double a, double b, double & error){
+	double p=a*b;
+#ifdef __FMA__
+	error=fma(a, b, -p);
+#else
+	const double split=134217729.0; // 2^27+1
+	double ta=split*a, tb=split*b;
+	double a_hi=ta-(ta-a), b_hi=tb-(tb-b);
+	double a_lo=a-a_hi, b_lo=b-b_hi;
+	error=((a_hi*b_hi-p)+a_hi*b_lo+a_lo*b_hi)+a_lo*b_lo;
+#endif
+	return p;
+}
+
+
+// FUNCTION - Arithmetic Operators
+
+// Sum, difference, product and quotient of two double_double numbers. Doubles and integers are converted implicitly.
+double_double operator+(const double_double & a, const double_double & b){
+	double e, f;
+	double s=two_sum(a.hi, b.hi, e);
+	double t=two_sum(a.lo, b.lo, f);
+	e+=t;
+	s=quick_two_sum(s, e, e);
+	e+=f;
+	s=quick_two_sum(s, e, e);
+	return double_double(s, e);
+}
+
+double_double operator-(const double_double & a){
+	return double_double(-a.hi, -a.lo);
+}
+
+double_double operator-(const double_double & a, const double_double & b){
+	return a+(-b);
+}
+
+double_double operator*(const double_double & a, const double_double & b){
+	double e;
+	double p=two_product(a.hi, b.hi, e);
+	e+=a.hi*b.lo+a.lo*b.hi;
+	p=quick_two_sum(p, e, e);
+	return double_double(p, e);
+}
+
+double_double operator/(const double_double & a, const double_double & b){
+	double q1=a.hi/b.hi; // Long division, one double of the quotient at a time.
+	double_double r=a-b*q1;
+	double q2=r.hi/b.hi;
+	r=r-b*q2;
+	double q3=r.hi/b.hi;
+	double e;
+	q1=quick_two_sum(q1, q2, e);
+	return double_double(q1, e)+q3;
+}
+
+double_double & operator+=(double_double & a, const double_double & b){
+	return a=a+b;
+}
+
+double_double & operator-=(double_double & a, const double_double & b){
+	return a=a-b;
+}
+
+double_double & operator*=(double_double & a, const double_double & b){
+	return a=a*b;
+}
+
+double_double & operator/=(double_double & a, const double_double & b){
+	return a=a/b;
+}
+
+
+// FUNCTION - Comparison Operators
+
+// Compare two double_double numbers by their leading parts, then by their trailing parts.
+bool operator==(const double_double & a, const double_double & b){
+	return (a.hi==b.hi)&&(a.lo==b.lo);
+}
+
+bool operator!=(const double_double & a, const double_double & b){
+	return !(a==b);
+}
+
+bool operator<(const double_double & a, const double_double & b){
+	return (a.hi<b.hi)||((a.hi==b.hi)&&(a.lo<b.lo));
+}
+
+bool operator>=(const double_double & a, const double_double & b){
+	return !(a<b);
+}
+
+
+// FUNCTION - Absolute Value
+
+// Returns |a|.
+double_double fabs(const double_double & a){
+	return (a.hi<0)?-a:a;
+}
+
+
+// FUNCTION - Exponential
+
+// Returns e^a. With a = k*log(2) + r, e^a = 2^k * e^r; r is divided by 2^10 so that a few terms of the series for
+// e^r - 1 are enough, and the result is squared back up 10 times as (1+s)^2 - 1 = s*(s+2), which keeps its precision.
+double_double exp(const double_double & a){
+	if (a.hi>709.8)
+		return double_double(HUGE_VAL);
+	if (a.hi<-745.2)
+		return double_double(0.0);
+	if (a.hi!=a.hi) // NaN
+		return a;
+	double k=nearbyint(a.hi/dd_ln2.hi);
+	double_double r=a-dd_ln2*k;
+	r=double_double(ldexp(r.hi, -10), ldexp(r.lo, -10));
+	double_double s=r, term=r;
+	for (int i=2; i<=12; i++){ // |r| < 3.4e-4, so 12 terms are more than enough.
+		term=term*r/double(i);
+		s+=term;
+		if (fabs(term.hi)<=dd_epsilon*fabs(s.hi))
+			break;
+	}
+	for (int i=0; i<10; i++)
+		s=s*(s+2.0);
+	s+=1.0;
+	return double_double(ldexp(s.hi, (int)k), ldexp(s.lo, (int)k));
+}
+
+
+// FUNCTION - Logarithm
+
+// Returns log(a), by one Newton step y + a*e^(-y) - 1 from the double logarithm y, which doubles its number of digits.
+double_double log(const double_double & a){
+	if (!(a.hi>0)||(a.hi==HUGE_VAL))
+		return double_double(log(a.hi));
+	double_double y=log(a.hi);
+	return y+a*exp(-y)-1.0;
+}
+
+
+// FUNCTION - Power
+
+// Returns a^b. Integer exponents, such as the 2 in pow(x,2), are done by repeated squaring, so that they also work for
+// a <= 0; other exponents use e^(b*log(a)).
+double_double pow(const double_double & a, const double_double & b){
+	if ((b.lo==0)&&(b.hi==floor(b.hi))&&(fabs(b.hi)<=1073741824.0)){
+		long n=(long)fabs(b.hi);
+		double_double result=1.0, base=a;
+		while (n>0){
+			if (n&1)
+				result*=base;
+			base*=base;
+			n>>=1;
+		}
+		return (b.hi<0)?1.0/result:result;
+	}
+	if (a.hi==0)
+		return double_double(pow(0.0, b.hi));
+	return exp(b*log(a));
+}
+
+
+// FUNCTION - Sine Cosine
+
+// Sets 's' and 'c' to sin(a) and cos(a). a is reduced by a multiple k of pi/2 to |r| <= pi/4, where the Taylor series
+// of sin(r) and cos(r) converge quickly, and k mod 4 decides which of them, and which sign, gives sin(a) and cos(a).
+void sin_cos(const double_double & a, double_double & s, double_double & c){
+	if (!(fabs(a.hi)<HUGE_VAL)){
+		s=c=double_double(NAN);
+		return;
+	}
+	double k=nearbyint(a.hi/dd_pi_2.hi);
+	double_double r=a-dd_pi_2*k;
+	double_double r2=r*r;
+	double_double sine=r, cosine=1.0, term=r;
+	for (int i=1; i<=20; i++){ // sin(r) = r - r^3/3! + r^5/5! - ...
+		term=-term*r2/double((2*i)*(2*i+1));
+		sine+=term;
+		if (fabs(term.hi)<=dd_epsilon*fabs(sine.hi))
+			break;
+	}
+	term=1.0;
+	for (int i=1; i<=20; i++){ // cos(r) = 1 - r^2/2! + r^4/4! - ...
+		term=-term*r2/double((2*i-1)*(2*i));
+		cosine+=term;
+		if (fabs(term.hi)<=dd_epsilon)
+			break;
+	}
+	switch ((((long)fmod(k, 4.0))+4)%4){
+		case 0: s=sine; c=cosine; break;
+		case 1: s=cosine; c=-sine; break;
+		case 2: s=-sine; c=-cosine; break;
+		case 3: s=-cosine; c=sine; break;
+	}
+}
+
+
+// FUNCTION - Sine, Cosine, Tangent
+
+// Return sin(a), cos(a) and tan(a).
+double_double sin(const double_double & a){
+	double_double s, c;
+	sin_cos(a, s, c);
+	return s;
+}
+
+double_double cos(const double_double & a){
+	double_double s, c;
+	sin_cos(a, s, c);
+	return c;
+}
+
+double_double tan(const double_double & a){
+	double_double s, c;
+	sin_cos(a, s, c);
+	return s/c;
+}
+
+// END DOUBLE-DOUBLE FUNCTIONS
+
+
+
+// START COMPILE FUNCTIONS
+
+
+// FUNCTION - Compile Node
+
+// Appends the instructions computing 'node' to 'expression' and returns the register holding its value. 'registers' maps
+// nodes that have already been compiled to their registers, so a subtree shared within the DAG is computed only once.
+int compile_node(const expression_node * node, compiled_expression & expression, unordered_map<const expression_node *, int> & registers){
+	unordered_map<const expression_node *, int>::iterator found=registers.find(node);
+	if (found!=registers.end()) // If this subtree has already been compiled...
+		return found->second;
+	instruction step;
+	step.type=node->type;
+	step.left=(node->left==nullptr)?-1:compile_node(node->left, expression, registers);
+	step.right=(node->right==nullptr)?-1:compile_node(node->right, expression, registers);
+	step.value=node->value;
+	step.order=node->order;
+	step.symbol=node->symbol;
+	expression.code.push_back(step);
+	registers[node]=expression.code.size()-1;
+	return expression.code.size()-1;
+}
+
+
+// FUNCTION - Compile Derivatives
+
+// Parses and simplifies each entry of symbolic_derivatives once and compiles it. Entry i may refer to x and to derivatives x' through
+// x^(i), which are computed by running the entries before it. An empty entry (such as an exact solution that was not given)
+// is compiled as zero. Returns false if an entry cannot be parsed.
+bool compile_derivatives(const vector<string> & symbolic_derivatives, int number_of_terms, compiled_derivatives & program){
+	expression_pool pool;
+	program.expressions.clear();
+	program.registers=0;
+	program.native=nullptr;
+	for (int i=0; i<symbolic_derivatives.size(); i++){ // For each expression...
+		const expression_node * node;
+		parse_error error;
+		if (symbolic_derivatives[i].empty())
+			node=make_constant(pool, 0);
+		else
+			node=parse_expression(symbolic_derivatives[i], pool, error);
+		if (node==nullptr){
+			cout<<"error: "<<describe_parse_error(symbolic_derivatives[i], error)<<endl;
+			return false;
+		}
+		node=simplify_expression(node, pool);
+		compiled_expression expression;
+		unordered_map<const expression_node *, int> registers;
+		compile_node(node, expression, registers);
+		for (int j=0; j<expression.code.size(); j++){ // Check that derivatives used by this expression are computed by an earlier one.
+			if ((expression.code[j].type==VARIABLE)&&(expression.code[j].order>min(i, number_of_terms))){
+				cout<<"error: "<<symbolic_derivatives[i]<<" refers to "<<pool.symbols[expression.code[j].symbol]+string(expression.code[j].order,'\'')<<", which is not computed before it"<<endl;
+				return false;
+			}
+		}
+		expression.offset=program.registers;
+		program.registers+=expression.code.size();
+		program.expressions.push_back(expression);
+	}
+	return true;
+}
+
+
+// FUNCTION - Compile Sequence
+
+// Compiles the first number_of_terms terms of 'sequence', followed by 'exact', in the same layout as compile_derivatives.
+// Terms not made yet are made now. The jet engine only runs x', so for JET_ENGINE the higher terms are compiled as zero
+// and never made. 'exact' may only be written in terms of x and t. Returns false if 'exact' cannot be used.
+bool compile_sequence(derivative_sequence & sequence, const string & exact, int number_of_terms, coefficient_engine engine, compiled_derivatives & program){
+	parse_error error;
+	const expression_node * node=exact.empty()?make_constant(sequence.pool, 0):parse_expression(exact, sequence.pool, error);
+	if (node==nullptr){
+		cout<<"error: "<<describe_parse_error(exact, error)<<endl;
+		return false;
+	}
+	compiled_expression expression;
+	unordered_map<const expression_node *, int> registers;
+	compile_node(simplify_expression(node, sequence.pool), expression, registers);
+	for (int j=0; j<expression.code.size(); j++){ // Check that the exact solution does not need any derivative.
+		if ((expression.code[j].type==VARIABLE)&&(expression.code[j].order>0)){
+			cout<<"error: "<<exact<<" refers to "<<sequence.pool.symbols[expression.code[j].symbol]+string(expression.code[j].order,'\'')<<", which is not computed before it"<<endl;
+			return false;
+		}
+	}
+	expression.offset=0;
+	program.expressions.assign(1, expression);
+	program.registers=expression.code.size();
+	program.native=nullptr;
+	grow_compiled(sequence, number_of_terms, engine, program);
+	return true;
+}
+
+
+// FUNCTION - Grow Compiled
+
+// Adds terms of 'sequence' to 'program' (built by compile_sequence) until it has number_of_terms of them, compiling only
+// the new ones. The exact solution moves to the end, and machine code built for the old expressions is dropped, since it
+// does not compute the new ones. Scratch space prepared for 'program' must be resized with resize_scratch.
+void grow_compiled(derivative_sequence & sequence, int number_of_terms, coefficient_engine engine, compiled_derivatives & program){
+	compiled_expression exact=program.expressions.back();
+	program.expressions.pop_back();
+	program.registers-=exact.code.size();
+	for (int i=program.expressions.size(); i<number_of_terms; i++){ // For each term not compiled yet...
+		const expression_node * node=((engine==JET_ENGINE)&&(i>0))?make_constant(sequence.pool, 0):sequence_term(sequence, i);
+		compiled_expression expression;
+		unordered_map<const expression_node *, int> registers;
+		compile_node(node, expression, registers);
+		expression.offset=program.registers;
+		program.registers+=expression.code.size();
+		program.expressions.push_back(expression);
+	}
+	exact.offset=program.registers;
+	program.registers+=exact.code.size();
+	program.expressions.push_back(exact);
+	program.native=nullptr;
+}
+
+
+// FUNCTION - Prepare Scratch
+
+// Sizes the scratch space so that it can hold the registers of every expression in 'program'.
+template<class scalar> void prepare_scratch(const compiled_derivatives & program, basic_evaluation_scratch<scalar> & scratch){
+	scratch.registers.assign(program.registers, scalar(0));
+	scratch.values.assign(program.expressions.size(), scalar(0));
+	scratch.known.assign(program.expressions.size(), 0);
+	scratch.values_valid=false;
+	scratch.runs.assign(program.expressions.size(), 0);
+	scratch.native_runs=0;
+	scratch.stack.assign(program.expressions.size(), 0.0);
+	scratch.stack_valid=false;
+}
+
+
+// FUNCTION - Resize Scratch
+
+// Resizes the scratch space after grow_compiled has added expressions to 'program', keeping the values of the derivatives
+// already found at the current point. The exact solution, which has moved to the end, is found again when next needed.
+template<class scalar> void resize_scratch(const compiled_derivatives & program, basic_evaluation_scratch<scalar> & scratch){
+	int exact=scratch.values.size()-1, count=program.expressions.size(); // Old and new index of the exact solution
+	long exact_runs=scratch.runs[exact];
+	scratch.registers.resize(program.registers, scalar(0));
+	scratch.values.resize(count, scalar(0));
+	scratch.known.resize(count, 0);
+	scratch.runs.resize(count, 0);
+	scratch.stack.resize(count, 0.0);
+	scratch.known[exact]=0;
+	scratch.runs[exact]=0;
+	scratch.known[count-1]=0;
+	scratch.runs[count-1]=exact_runs;
+	scratch.stack_valid=false;
+}
+
+
+// FUNCTION - Evaluate
+
+// Evaluates expression 'index' of 'program', as a function of x and t, by running its instructions in order. A derivative
+// x^(k) of x is the value of expression k-1, taken from derivative_value() so that it is only computed once at each
+// (x,t). Each expression has its own registers in 'scratch', so this never overwrites the registers of the expression
+// that asked for the derivative.
+template<class scalar> scalar evaluate(const compiled_derivatives & program, int index, basic_evaluation_scratch<scalar> & scratch, scalar x, scalar t){
+	const compiled_expression & expression=program.expressions[index];
+	scalar * r=&scratch.registers[expression.offset];
+	for (int i=0; i<expression.code.size(); i++){ // For each instruction...
+		const instruction & step=expression.code[i];
+		switch (step.type){
+			case CONSTANT: r[i]=scalar(step.value); break;
+			case VARIABLE: r[i]=(step.order==0)?x:derivative_value(program, step.order-1, scratch, x, t); break;
+			case TIME: r[i]=t; break;
+			case ADD: r[i]=r[step.left]+r[step.right]; break;
+			case SUBTRACT: r[i]=r[step.left]-r[step.right]; break;
+			case MULTIPLY: r[i]=r[step.left]*r[step.right]; break;
+			case DIVIDE: r[i]=r[step.left]/r[step.right]; break;
+			case NEGATE: r[i]=-r[step.left]; break;
+			case EXPONENTIAL: r[i]=exp(r[step.left]); break;
+			case LOGARITHM: r[i]=log(r[step.left]); break;
+			case POWER: r[i]=pow(r[step.left], r[step.right]); break;
+			case SINE: r[i]=sin(r[step.left]); break;
+			case COSINE: r[i]=cos(r[step.left]); break;
+			case TANGENT: r[i]=tan(r[step.left]); break;
+		}
+	}
+	return r[expression.code.size()-1];
+}
+
+
+// FUNCTION - Derivative Value
+
+// Returns the value of expression 'index' of 'program' at (x,t), evaluating it only if it has not already been evaluated
+// at this point. Moving to a new point forgets all cached values, so a step of the Taylor method costs one run of each
+// expression, rather than one run for every reference to a lower derivative.
+template<class scalar> scalar derivative_value(const compiled_derivatives & program, int index, basic_evaluation_scratch<scalar> & scratch, scalar x, scalar t){
+	if (!scratch.values_valid||(x!=scratch.values_x)||(t!=scratch.values_t)){ // If the values are for another point...
+		fill(scratch.known.begin(), scratch.known.end(), 0);
+		scratch.values_x=x;
+		scratch.values_t=t;
+		scratch.values_valid=true;
+	}
+	if (!scratch.known[index]){
+		scratch.values[index]=evaluate(program, index, scratch, x, t);
+		scratch.known[index]=1;
+		scratch.runs[index]++;
+	}
+	return scratch.values[index];
+}
+
+// END COMPILE FUNCTIONS
+
+
+
+// START BATCH FUNCTIONS
+
+// The functions in this section work on blocks of batch_lanes points. Each 'lane' function below computes an elementary
+// function using only arithmetic and bit operations, without branches or even conditional selections (the compiler
+// turns those back into branches), so that a loop applying it to a block can be vectorized. They are accurate to within
+// a few units in the last place for ordinary arguments; arguments outside the range they handle (overflow, non-positive
+// logarithms, huge angles, infinities and NaN) are flagged and recomputed with the standard library, so results agree
+// with evaluate() in every case.
+
+#if defined(__GNUC__)
+#define BATCH_INLINE inline __attribute__((always_inline))
+#define BATCH_OPTIMIZE __attribute__((optimize("O3")))
+#else
+#define BATCH_INLINE inline
+#define BATCH_OPTIMIZE
+#endif
+
+
+// FUNCTION - Bits To Double / Double To Bits
+
+BATCH_INLINE double bits_to_double(uint64_t bits){
+	double value;
+	memcpy(&value,&bits,sizeof(double));
+	return value;
+}
+
+BATCH_INLINE uint64_t double_to_bits(double value){
+	uint64_t bits;
+	memcpy(&bits,&value,sizeof(double));
+	return bits;
+}
+
+
+// FUNCTION - Lane Exp
+
+// exp(v) for -708 <= v <= 709. Writes v=k*log(2)+r with |r| <= log(2)/2, evaluates exp(r) by its Taylor polynomial,
+// and scales by 2^k by building the exponent bits directly.
+BATCH_INLINE double lane_exp(double v){
+	const double shift=6755399441055744.0; // 1.5*2^52: adding it rounds to an integer held in the low bits
+	double kd=v*1.4426950408889634+shift;
+	double k=kd-shift;
+	double r=(v-k*6.93147180369123816490e-01)-k*1.90821492927058770002e-10;
+	double p=1.0/6227020800.0;
+	p=p*r+1.0/479001600.0;
+	p=p*r+1.0/39916800.0;
+	p=p*r+1.0/3628800.0;
+	p=p*r+1.0/362880.0;
+	p=p*r+1.0/40320.0;
+	p=p*r+1.0/5040.0;
+	p=p*r+1.0/720.0;
+	p=p*r+1.0/120.0;
+	p=p*r+1.0/24.0;
+	p=p*r+1.0/6.0;
+	p=p*r+0.5;
+	p=p*r+1.0;
+	p=p*r+1.0;
+	uint64_t scale=(double_to_bits(kd)-double_to_bits(shift)+1023)<<52;
+	return p*bits_to_double(scale);
+}
+
+
+// FUNCTION - Lane Log
+
+// log(v) for positive, normal, finite v. Writes v=2^e*m with sqrt(1/2) <= m < sqrt(2) and uses the series
+// log(m)=2*(s+s^3/3+s^5/5+...) with s=(m-1)/(m+1).
+BATCH_INLINE double lane_log(double v){
+	uint64_t bits=double_to_bits(v);
+	uint64_t high=((bits&0x000FFFFFFFFFFFFFULL)>0x6A09E667F3BCDULL); // 1 if mantissa is above sqrt(2), in which case m is halved
+	double e=bits_to_double(0x4330000000000000ULL|((bits>>52)+high))-4503599627370496.0-1023.0; // Exponent, converted to double through the mantissa of 2^52.
+	double m=bits_to_double((bits&0x000FFFFFFFFFFFFFULL)|(0x3FF0000000000000ULL-(high<<52)));
+	double s=(m-1.0)/(m+1.0);
+	double z=s*s;
+	double p=1.0/23.0;
+	p=p*z+1.0/21.0;
+	p=p*z+1.0/19.0;
+	p=p*z+1.0/17.0;
+	p=p*z+1.0/15.0;
+	p=p*z+1.0/13.0;
+	p=p*z+1.0/11.0;
+	p=p*z+1.0/9.0;
+	p=p*z+1.0/7.0;
+	p=p*z+1.0/5.0;
+	p=p*z+1.0/3.0;
+	return e*6.93147180369123816490e-01+(2.0*s+2.0*s*z*p+e*1.90821492927058770002e-10);
+}
+
+
+// FUNCTION - Lane Sin Cos
+
+// sin(v) and cos(v) for |v| <= 1e5. Writes v=q*pi/2+r with |r| <= pi/4, evaluates the Taylor polynomials of sin(r) and
+// cos(r), and picks and negates them according to the quadrant q.
+BATCH_INLINE void lane_sin_cos(double v, double & sine, double & cosine){
+	const double shift=6755399441055744.0;
+	double qd=v*6.36619772367581382433e-01+shift;
+	double q=qd-shift;
+	double r=((v-q*1.57079632673412561417e+00)-q*6.07710050630396597660e-11)-q*2.02226624871116645580e-21;
+	uint64_t quadrant=double_to_bits(qd)-double_to_bits(shift);
+	double z=r*r;
+	double ps=-1.0/121645100408832000.0; // sin(r)=r*(1-z/3!+z^2/5!-...), up to r^19
+	ps=ps*z+1.0/355687428096000.0;
+	ps=ps*z-1.0/1307674368000.0;
+	ps=ps*z+1.0/6227020800.0;
+	ps=ps*z-1.0/39916800.0;
+	ps=ps*z+1.0/362880.0;
+	ps=ps*z-1.0/5040.0;
+	ps=ps*z+1.0/120.0;
+	ps=ps*z-1.0/6.0;
+	double s=r+r*z*ps;
+	double pc=1.0/2432902008176640000.0; // cos(r)=1-z/2!+z^2/4!-..., up to r^20
+	pc=pc*z-1.0/6402373705728000.0;
+	pc=pc*z+1.0/20922789888000.0;
+	pc=pc*z-1.0/87178291200.0;
+	pc=pc*z+1.0/479001600.0;
+	pc=pc*z-1.0/3628800.0;
+	pc=pc*z+1.0/40320.0;
+	pc=pc*z-1.0/720.0;
+	pc=pc*z+1.0/24.0;
+	pc=pc*z-0.5;
+	double c=1.0+z*pc;
+	uint64_t swap=0-(quadrant&1); // All bits set in odd quadrants, where sin and cos trade places
+	uint64_t sin_bits=(double_to_bits(c)&swap)|(double_to_bits(s)&~swap);
+	uint64_t cos_bits=(double_to_bits(s)&swap)|(double_to_bits(c)&~swap);
+	sine=bits_to_double(sin_bits^((quadrant&2)<<62)); // Flip sign bit in quadrants 2 and 3...
+	cosine=bits_to_double(cos_bits^(((quadrant+1)&2)<<62)); // ...and in quadrants 1 and 2.
+}
+
+
+// FUNCTION - Block Exp / Log / Sin / Cos / Tan / Pow
+
+// Apply an elementary function to a block of arguments 'a', writing to 'out'. Lanes whose arguments are outside the range
+// handled by the lane functions are recomputed with the standard library afterwards.
+
+BATCH_INLINE void block_exp(const double * a, double * out){
+	int special=0;
+	for (int l=0; l<batch_lanes; l++){
+		special|=!((a[l]>=-708.0)&(a[l]<=709.0));
+		out[l]=lane_exp(a[l]);
+	}
+	if (special)
+		for (int l=0; l<batch_lanes; l++)
+			if (!((a[l]>=-708.0)&&(a[l]<=709.0)))
+				out[l]=exp(a[l]);
+}
+
+BATCH_INLINE void block_log(const double * a, double * out){
+	int special=0;
+	for (int l=0; l<batch_lanes; l++){
+		special|=!((a[l]>=2.2250738585072014e-308)&(a[l]<=1.7976931348623157e308));
+		out[l]=lane_log(a[l]);
+	}
+	if (special)
+		for (int l=0; l<batch_lanes; l++)
+			if (!((a[l]>=2.2250738585072014e-308)&&(a[l]<=1.7976931348623157e308)))
+				out[l]=log(a[l]);
+}
+
+// 'kind' is SINE, COSINE or TANGENT.
+BATCH_INLINE void block_trigonometric(node_type kind, const double * a, double * out){
+	int special=0;
+	double sine, cosine;
+	for (int l=0; l<batch_lanes; l++)
+		special|=!((a[l]>=-1e5)&(a[l]<=1e5));
+	if (kind==SINE)
+		for (int l=0; l<batch_lanes; l++){
+			lane_sin_cos(a[l], sine, cosine);
+			out[l]=sine;
+		}
+	else if (kind==COSINE)
+		for (int l=0; l<batch_lanes; l++){
+			lane_sin_cos(a[l], sine, cosine);
+			out[l]=cosine;
+		}
+	else
+		for (int l=0; l<batch_lanes; l++){
+			lane_sin_cos(a[l], sine, cosine);
+			out[l]=sine/cosine;
+		}
+	if (special)
+		for (int l=0; l<batch_lanes; l++)
+			if (!((a[l]>=-1e5)&&(a[l]<=1e5)))
+				out[l]=(kind==SINE)?sin(a[l]):((kind==COSINE)?cos(a[l]):tan(a[l]));
+}
+
+// Raises a block to an integer power n (the same for every lane) by repeated squaring, which is exact for small n and
+// also handles negative bases, unlike exp(n*log(a)).
+BATCH_INLINE void block_integer_power(const double * a, int n, double * out){
+	double base[batch_lanes];
+	for (int l=0; l<batch_lanes; l++){
+		base[l]=a[l];
+		out[l]=1.0;
+	}
+	for (int m=abs(n); m>0; m>>=1){
+		if (m&1)
+			for (int l=0; l<batch_lanes; l++)
+				out[l]*=base[l];
+		for (int l=0; l<batch_lanes; l++)
+			base[l]*=base[l];
+	}
+	if (n<0)
+		for (int l=0; l<batch_lanes; l++)
+			out[l]=1.0/out[l];
+}
+
+// General power a^b=exp(b*log(a)), for positive a.
+BATCH_INLINE void block_power(const double * a, const double * b, double * out){
+	int special=0;
+	for (int l=0; l<batch_lanes; l++){
+		double v=b[l]*lane_log(a[l]);
+		special|=!((a[l]>=2.2250738585072014e-308)&(a[l]<=1.7976931348623157e308)&(v>=-708.0)&(v<=709.0));
+		out[l]=lane_exp(v);
+	}
+	if (special)
+		for (int l=0; l<batch_lanes; l++){
+			bool base_in_range=(a[l]>=2.2250738585072014e-308)&&(a[l]<=1.7976931348623157e308);
+			double v=base_in_range?b[l]*log(a[l]):0.0;
+			if (!(base_in_range&&(v>=-708.0)&&(v<=709.0)))
+				out[l]=pow(a[l], b[l]);
+		}
+}
+
+
+// FUNCTION - Run Batch Block
+
+// Evaluates expression 'index' for the batch_lanes points held in scratch.x and scratch.t, writing to scratch.out. The
+// expressions flagged in scratch.needed are run in increasing order, so that when an expression refers to x^(k), the
+// result of expression k-1 for the whole block is already available.
+BATCH_INLINE void run_batch_block(const compiled_derivatives & program, int index, batch_scratch & scratch){
+	for (int e=0; e<=index; e++){ // For each expression that must be run...
+		if (!scratch.needed[e])
+			continue;
+		const compiled_expression & expression=program.expressions[e];
+		double * r=&scratch.registers[expression.offset*batch_lanes];
+		for (int i=0; i<expression.code.size(); i++){ // For each instruction...
+			const instruction & step=expression.code[i];
+			double * out=r+i*batch_lanes;
+			const double * a=(step.left>=0)?r+step.left*batch_lanes:nullptr; // Operands, for the instructions that have them
+			const double * b=(step.right>=0)?r+step.right*batch_lanes:nullptr;
+			switch (step.type){
+				case CONSTANT:
+					for (int l=0; l<batch_lanes; l++) out[l]=step.value;
+					break;
+				case VARIABLE:
+					a=(step.order==0)?scratch.x:&scratch.results[(step.order-1)*batch_lanes];
+					for (int l=0; l<batch_lanes; l++) out[l]=a[l];
+					break;
+				case TIME:
+					for (int l=0; l<batch_lanes; l++) out[l]=scratch.t[l];
+					break;
+				case ADD:
+					for (int l=0; l<batch_lanes; l++) out[l]=a[l]+b[l];
+					break;
+				case SUBTRACT:
+					for (int l=0; l<batch_lanes; l++) out[l]=a[l]-b[l];
+					break;
+				case MULTIPLY:
+					for (int l=0; l<batch_lanes; l++) out[l]=a[l]*b[l];
+					break;
+				case DIVIDE:
+					for (int l=0; l<batch_lanes; l++) out[l]=a[l]/b[l];
+					break;
+				case NEGATE:
+					for (int l=0; l<batch_lanes; l++) out[l]=-a[l];
+					break;
+				case EXPONENTIAL:
+					block_exp(a, out);
+					break;
+				case LOGARITHM:
+					block_log(a, out);
+					break;
+				case POWER:
+					if ((expression.code[step.right].type==CONSTANT)&&(expression.code[step.right].value==floor(expression.code[step.right].value))&&(fabs(expression.code[step.right].value)<=64))
+						block_integer_power(a, (int)expression.code[step.right].value, out);
+					else
+						block_power(a, b, out);
+					break;
+				case SINE:
+				case COSINE:
+				case TANGENT:
+					block_trigonometric(step.type, a, out);
+					break;
+			}
+		}
+		const double * result=r+(expression.code.size()-1)*batch_lanes;
+		double * saved=(e==index)?scratch.out:&scratch.results[e*batch_lanes];
+		for (int l=0; l<batch_lanes; l++)
+			saved[l]=result[l];
+	}
+}
+
+
+// FUNCTION - Evaluate Batch Kernel
+
+// Evaluates expression 'index' at the 'count' points (x[i], t[i]), writing results to out[i]. The last block is padded by
+// repeating the last point. This function is compiled once for each instruction set below.
+BATCH_INLINE void evaluate_batch_kernel(const compiled_derivatives & program, int index, batch_scratch & scratch, const double * x, const double * t, double * out, int count){
+	for (int start=0; start<count; start+=batch_lanes){ // For each block of points...
+		int lanes=min(batch_lanes, count-start);
+		for (int l=0; l<batch_lanes; l++){
+			scratch.x[l]=x[start+min(l, lanes-1)];
+			scratch.t[l]=t[start+min(l, lanes-1)];
+		}
+		run_batch_block(program, index, scratch);
+		for (int l=0; l<lanes; l++)
+			out[start+l]=scratch.out[l];
+	}
+}
+
+typedef void (*batch_kernel)(const compiled_derivatives &, int, batch_scratch &, const double *, const double *, double *, int);
+
+// Baseline version, using whatever vector instructions the whole program is compiled for (SSE2 on x86-64). Each version is
+// optimized at -O3 regardless of how the rest of the program is built, because lower levels do not vectorize these loops.
+BATCH_OPTIMIZE void evaluate_batch_sse(const compiled_derivatives & program, int index, batch_scratch & scratch, const double * x, const double * t, double * out, int count){
+	evaluate_batch_kernel(program, index, scratch, x, t, out, count);
+}
+
+#if defined(__GNUC__)&&(defined(__x86_64__)||defined(__i386__))
+__attribute__((target("avx2,fma"))) BATCH_OPTIMIZE
+void evaluate_batch_avx2(const compiled_derivatives & program, int index, batch_scratch & scratch, const double * x, const double * t, double * out, int count){
+	evaluate_batch_kernel(program, index, scratch, x, t, out, count);
+}
+
+__attribute__((target("avx512f,avx512dq,fma,prefer-vector-width=512"))) BATCH_OPTIMIZE
+void evaluate_batch_avx512(const compiled_derivatives & program, int index, batch_scratch & scratch, const double * x, const double * t, double * out, int count){
+	evaluate_batch_kernel(program, index, scratch, x, t, out, count);
+}
+#endif
+
+
+// FUNCTION - Select Batch Kernel
+
+// Chooses the widest version of the batch kernel that the processor running the program supports. 'name' is set to a
+// description of the chosen version.
+batch_kernel select_batch_kernel(const char * & name){
+#if defined(__GNUC__)&&(defined(__x86_64__)||defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")&&__builtin_cpu_supports("avx512dq")){
+		name="avx512";
+		return evaluate_batch_avx512;
+	}
+	if (__builtin_cpu_supports("avx2")&&__builtin_cpu_supports("fma")){
+		name="avx2";
+		return evaluate_batch_avx2;
+	}
+#endif
+	name="sse";
+	return evaluate_batch_sse;
+}
+
+const char * selected_batch_kernel_name;
+const batch_kernel selected_batch_kernel=select_batch_kernel(selected_batch_kernel_name);
+
+
+// FUNCTION - Batch Kernel Name
+
+// Returns the name of the instruction set used by evaluate_batch.
+const char * batch_kernel_name(){
+	return selected_batch_kernel_name;
+}
+
+
+// FUNCTION - Prepare Batch Scratch
+
+// Sizes the batch scratch space for 'program'. After this, evaluate_batch does not allocate memory.
+void prepare_batch_scratch(const compiled_derivatives & program, batch_scratch & scratch){
+	scratch.registers.assign(program.registers*batch_lanes, 0.0);
+	scratch.results.assign(program.expressions.size()*batch_lanes, 0.0);
+	scratch.needed.assign(program.expressions.size(), 0);
+}
+
+
+// FUNCTION - Evaluate Batch
+
+// Evaluates expression 'index' of 'program' at the 'count' points given as separate arrays x[] and t[], writing results to
+// out[]. Gives the same results as calling evaluate() for each point, up to rounding in the last few bits.
+void evaluate_batch(const compiled_derivatives & program, int index, batch_scratch & scratch, const double * x, const double * t, double * out, int count){
+	if (count<=0)
+		return;
+
+	// STEP 1 - Flag the expression and every lower derivative it refers to, directly or through other derivatives.
+	for (int e=0; e<program.expressions.size(); e++)
+		scratch.needed[e]=(e==index);
+	for (int e=index; e>=0; e--){
+		if (!scratch.needed[e])
+			continue;
+		const compiled_expression & expression=program.expressions[e];
+		for (int i=0; i<expression.code.size(); i++)
+			if ((expression.code[i].type==VARIABLE)&&(expression.code[i].order>0))
+				scratch.needed[expression.code[i].order-1]=1;
+	}
+
+	// STEP 2 - Run the blocks with the kernel selected for this processor.
+	selected_batch_kernel(program, index, scratch, x, t, out, count);
+}
+
+// END BATCH FUNCTIONS
+
+
+
+// START JET FUNCTIONS
+
+// In this section, u and v are the series of the operands of an instruction, w is the series of its result, and the
+// subscript k is the coefficient of (s-t)^k when expanding about the current time t. Coefficient k of every register
+// only depends on coefficients 0 to k of its operands, so coefficient k of x'(x,t) can be found once coefficients 0 to k
+// of x are known, and then gives coefficient k+1 of x. Finding all number_of_terms coefficients this way costs
+// O(number_of_terms^2) operations per instruction of x', however large the symbolic derivatives would have grown.
+
+
+// FUNCTION - Integer Exponent
+
+// If 'step' is a power with a constant integer exponent from 0 to 16, returns the exponent. Otherwise returns -1.
+int integer_exponent(const compiled_expression & expression, const instruction & step){
+	if (step.type!=POWER)
+		return -1;
+	const instruction & exponent=expression.code[step.right];
+	if ((exponent.type==CONSTANT)&&(exponent.value==floor(exponent.value))&&(exponent.value>=0)&&(exponent.value<=16))
+		return (int)exponent.value;
+	return -1;
+}
+
+
+// FUNCTION - Prepare Jet Scratch
+
+// Sizes the jet scratch space for x' (the first expression of 'program') and number_of_terms Taylor coefficients.
+template<class scalar> void prepare_jet_scratch(const compiled_derivatives & program, int number_of_terms, basic_jet_scratch<scalar> & scratch){
+	const compiled_expression & expression=program.expressions[0];
+	scratch.length=number_of_terms+1;
+	scratch.aux.assign(expression.code.size(), -1);
+	int size=expression.code.size()*scratch.length; // Main series come first...
+	for (int i=0; i<expression.code.size(); i++){ // ...then auxiliary series of the instructions that need them.
+		const instruction & step=expression.code[i];
+		int count=0;
+		if ((step.type==SINE)||(step.type==COSINE)||(step.type==TANGENT))
+			count=1; // cos(u) for sin(u), sin(u) for cos(u), 1+tan(u)^2 for tan(u)
+		else if (integer_exponent(expression, step)>2)
+			count=integer_exponent(expression, step)-2; // u^2, u^3, ... u^(n-1)
+		else if ((step.type==POWER)&&(expression.code[step.right].type!=CONSTANT))
+			count=2; // log(u) and v*log(u)
+		if (count>0){
+			scratch.aux[i]=size;
+			size+=count*scratch.length;
+		}
+	}
+	scratch.series.assign(size, scalar(0));
+}
+
+
+// FUNCTION - Series Product
+
+// Returns coefficient k of the product of two series, u_0*v_k + u_1*v_(k-1) + ... + u_k*v_0.
+template<class scalar> scalar series_product(const scalar * u, const scalar * v, int k){
+	scalar sum=0;
+	for (int j=0; j<=k; j++)
+		sum+=u[j]*v[k-j];
+	return sum;
+}
+
+
+// FUNCTION - Taylor Coefficients
+
+// Computes the Taylor coefficients of the solution x through the point (t, x): coefficients[k] = x^(k)(t)/k! for k from 0 to
+// number_of_terms. Only x' (the first expression of 'program') is used.
+template<class scalar> void taylor_coefficients(const compiled_derivatives & program, basic_jet_scratch<scalar> & scratch, scalar x, scalar t, int number_of_terms, scalar * coefficients){
+	const compiled_expression & expression=program.expressions[0];
+	int n=scratch.length;
+	scalar * S=&scratch.series[0];
+	coefficients[0]=x;
+	for (int k=0; k<number_of_terms; k++){ // For each coefficient of x'...
+		for (int i=0; i<expression.code.size(); i++){ // ...compute coefficient k of each register.
+			const instruction & step=expression.code[i];
+			scalar * w=S+i*n;
+			const scalar * u=(step.left>=0)?S+step.left*n:nullptr; // Operands and auxiliary series, for the instructions that have them
+			const scalar * v=(step.right>=0)?S+step.right*n:nullptr;
+			scalar * a=(scratch.aux[i]>=0)?S+scratch.aux[i]:nullptr;
+			scalar sum;
+			switch (step.type){
+				case CONSTANT:
+					w[k]=scalar((k==0)?step.value:0.0);
+					break;
+				case VARIABLE: // Only x itself can appear in x'.
+					w[k]=coefficients[k];
+					break;
+				case TIME: // Series of t+s is t + 1*s.
+					w[k]=(k==0)?t:scalar((k==1)?1.0:0.0);
+					break;
+				case ADD:
+					w[k]=u[k]+v[k];
+					break;
+				case SUBTRACT:
+					w[k]=u[k]-v[k];
+					break;
+				case MULTIPLY:
+					w[k]=series_product(u, v, k);
+					break;
+				case DIVIDE: // From u=w*v: w_k = (u_k - sum_{j<k} w_j*v_(k-j)) / v_0
+					sum=u[k];
+					for (int j=0; j<k; j++)
+						sum-=w[j]*v[k-j];
+					w[k]=sum/v[0];
+					break;
+				case NEGATE:
+					w[k]=-u[k];
+					break;
+				case EXPONENTIAL: // From w'=u'*w: w_k = (1/k) sum_{j=1..k} j*u_j*w_(k-j)
+					if (k==0)
+						w[0]=exp(u[0]);
+					else {
+						sum=0;
+						for (int j=1; j<=k; j++)
+							sum+=j*u[j]*w[k-j];
+						w[k]=sum/k;
+					}
+					break;
+				case LOGARITHM: // From u*w'=u': w_k = (u_k - (1/k) sum_{j=1..k-1} j*w_j*u_(k-j)) / u_0
+					if (k==0)
+						w[0]=log(u[0]);
+					else {
+						sum=0;
+						for (int j=1; j<k; j++)
+							sum+=j*w[j]*u[k-j];
+						w[k]=(u[k]-sum/k)/u[0];
+					}
+					break;
+				case SINE: // sin(u)'=u'*cos(u) and cos(u)'=-u'*sin(u); the cos series is kept in the auxiliary series.
+				case COSINE:
+				case TANGENT: // tan(u)'=u'*(1+tan(u)^2); the series of 1+tan(u)^2 is kept in the auxiliary series.
+					if (k==0){
+						if (step.type==TANGENT){
+							w[0]=tan(u[0]);
+							a[0]=1+w[0]*w[0];
+						}
+						else {
+							w[0]=(step.type==SINE)?sin(u[0]):cos(u[0]);
+							a[0]=(step.type==SINE)?cos(u[0]):sin(u[0]);
+						}
+					}
+					else {
+						scalar * sine=(step.type==COSINE)?a:w;
+						scalar * cosine=(step.type==COSINE)?w:a;
+						if (step.type==TANGENT){
+							sum=0;
+							for (int j=1; j<=k; j++)
+								sum+=j*u[j]*a[k-j];
+							w[k]=sum/k;
+							a[k]=series_product(w, w, k);
+						}
+						else {
+							scalar sum_sine=0, sum_cosine=0;
+							for (int j=1; j<=k; j++){
+								sum_sine+=j*u[j]*cosine[k-j];
+								sum_cosine+=j*u[j]*sine[k-j];
+							}
+							sine[k]=sum_sine/k;
+							cosine[k]=-sum_cosine/k;
+						}
+					}
+					break;
+				case POWER:
+					if (integer_exponent(expression, step)>=0){ // u^n by repeated products, which also works when u_0 is zero.
+						int exponent=integer_exponent(expression, step);
+						if (exponent==0)
+							w[k]=scalar((k==0)?1.0:0.0);
+						else if (exponent==1)
+							w[k]=u[k];
+						else {
+							const scalar * previous=u; // u^1
+							for (int m=2; m<exponent; m++){ // u^m, stored in auxiliary series m-2
+								scalar * current=a+(m-2)*n;
+								current[k]=series_product(previous, u, k);
+								previous=current;
+							}
+							w[k]=series_product(previous, u, k);
+						}
+					}
+					else if (expression.code[step.right].type==CONSTANT){ // From u*w'=c*u'*w: w_k = sum_{j<k} (c*(k-j)-j)*u_(k-j)*w_j / (k*u_0)
+						double c=expression.code[step.right].value;
+						if (k==0)
+							w[0]=pow(u[0], c);
+						else {
+							sum=0;
+							for (int j=0; j<k; j++)
+								sum+=(c*(k-j)-j)*u[k-j]*w[j];
+							w[k]=sum/(k*u[0]);
+						}
+					}
+					else { // u^v = exp(v*log(u)), with log(u) and v*log(u) in the auxiliary series
+						scalar * L=a;
+						scalar * M=a+n;
+						if (k==0){
+							L[0]=log(u[0]);
+							M[0]=v[0]*L[0];
+							w[0]=exp(M[0]);
+						}
+						else {
+							sum=0;
+							for (int j=1; j<k; j++)
+								sum+=j*L[j]*u[k-j];
+							L[k]=(u[k]-sum/k)/u[0];
+							M[k]=series_product(v, L, k);
+							sum=0;
+							for (int j=1; j<=k; j++)
+								sum+=j*M[j]*w[k-j];
+							w[k]=sum/k;
+						}
+					}
+					break;
+			}
+		}
+		coefficients[k+1]=S[(expression.code.size()-1)*n+k]/(k+1); // x' has coefficient k, so x has coefficient k+1.
+	}
+}
+
+// END JET FUNCTIONS
+
+
+
+// START JIT FUNCTIONS
+
+
+// Directory, within the user's cache directory, in which generated code and shared objects are kept, unless
+// DERIVATIVE_JIT_CACHE is set.
+const char * jit_default_cache="derivative_jit_cache";
+
+
+// FUNCTION - Private Directory
+
+// Returns true if 'path' is a directory, not a symbolic link, owned by this user, that no other user can write to.
+bool private_directory(const string & path){
+	struct stat status;
+	return (lstat(path.c_str(), &status)==0)&&S_ISDIR(status.st_mode)&&(status.st_uid==geteuid())&&((status.st_mode&(S_IWGRP|S_IWOTH))==0);
+}
+
+
+// FUNCTION - Private File
+
+// Returns true if 'path' is a regular file, not a symbolic link, owned by this user, that no other user can write to.
+bool private_file(const string & path){
+	struct stat status;
+	return (lstat(path.c_str(), &status)==0)&&S_ISREG(status.st_mode)&&(status.st_uid==geteuid())&&((status.st_mode&(S_IWGRP|S_IWOTH))==0);
+}
+
+
+// FUNCTION - Cache Directory
+
+// Sets 'directory' to the directory named by the environment variable 'variable', or else to 'name' within
+// $XDG_CACHE_HOME (or ~/.cache), creating it with access for this user only if it does not exist. Returns false if
+// there is no such directory, or if another user owns it or could write to it, so that nothing is loaded from it.
+bool cache_directory(const char * variable, const char * name, string & directory){
+	const char * chosen=getenv(variable);
+	if (chosen!=nullptr)
+		directory=chosen;
+	else {
+		const char * base=getenv("XDG_CACHE_HOME");
+		const char * home=getenv("HOME");
+		if ((base!=nullptr)&&(base[0]=='/'))
+			directory=base;
+		else if ((home!=nullptr)&&(home[0]=='/'))
+			directory=string(home)+"/.cache";
+		else
+			return false;
+		mkdir(directory.c_str(), 0700);
+		directory+=string("/")+name;
+	}
+	mkdir(directory.c_str(), 0700);
+	return private_directory(directory);
+}
+
+
+// FUNCTION - FNV-1a Hash
+
+// Returns the 64-bit FNV-1a hash of a string. Unlike std::hash, it is the same in every build, so it can name files
+// that are reused by later runs.
+uint64_t fnv1a_hash(const string & str){
+	uint64_t hash=14695981039346656037ULL;
+	for (int i=0; i<str.length(); i++){ // For each character...
+		hash^=(unsigned char)str[i];
+		hash*=1099511628211ULL;
+	}
+	return hash;
+}
+
+
+// FUNCTION - C Constant
+
+// Writes a constant as a C hexadecimal floating-point literal, so that the machine code uses exactly the same value.
+string c_constant(double value){
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "(%a)", value);
+	return buffer;
+}
+
+
+// FUNCTION - JIT Source
+
+// Writes C source for one function that computes every expression of 'program' in order, storing expression i in v[i].
+// Register j of expression i becomes the local variable r<offset+j>, and x^(k) is read from v[k-1], which was computed
+// by an earlier expression.
+string jit_source(const compiled_derivatives & program){
+	string source="#include <math.h>\n\nvoid derivative_stack(double x, double t, double * v){\n";
+	for (int i=0; i<program.expressions.size(); i++){ // For each expression...
+		const compiled_expression & expression=program.expressions[i];
+		source+="\t{\n";
+		for (int j=0; j<expression.code.size(); j++){ // For each instruction...
+			const instruction & step=expression.code[j];
+			string l=(step.left>=0)?"r"+to_string(expression.offset+step.left):"";
+			string r=(step.right>=0)?"r"+to_string(expression.offset+step.right):"";
+			string value;
+			switch (step.type){
+				case CONSTANT: value=c_constant(step.value); break;
+				case VARIABLE: value=(step.order==0)?"x":"v["+to_string(step.order-1)+"]"; break;
+				case TIME: value="t"; break;
+				case ADD: value=l+"+"+r; break;
+				case SUBTRACT: value=l+"-"+r; break;
+				case MULTIPLY: value=l+"*"+r; break;
+				case DIVIDE: value=l+"/"+r; break;
+				case NEGATE: value="-"+l; break;
+				case EXPONENTIAL: value="exp("+l+")"; break;
+				case LOGARITHM: value="log("+l+")"; break;
+				case POWER: value="pow("+l+","+r+")"; break;
+				case SINE: value="sin("+l+")"; break;
+				case COSINE: value="cos("+l+")"; break;
+				case TANGENT: value="tan("+l+")"; break;
+			}
+			source+="\t\tconst double r"+to_string(expression.offset+j)+"="+value+";\n";
+		}
+		source+="\t\tv["+to_string(i)+"]=r"+to_string(expression.offset+expression.code.size()-1)+";\n\t}\n";
+	}
+	source+="}\n";
+	return source;
+}
+
+
+// FUNCTION - JIT Compile
+
+// Compiles 'program' to machine code with the system C compiler ($CC, or cc), loads it with dlopen, and sets
+// program.native. The shared object is kept in $DERIVATIVE_JIT_CACHE (or jit_default_cache in the user's cache
+// directory), named by a hash of the source and the compiler command, so a later run with the same derivatives loads it
+// without compiling; 'cached' is set to true when that happens. Since loading runs the code, nothing is loaded unless
+// the directory and the file belong to this user and no one else can write to them. Returns false, leaving
+// program.native unset, if the code cannot be built or loaded.
+bool jit_compile(compiled_derivatives & program, bool & cached){
+	const char * compiler=getenv("CC");
+	string command=string((compiler!=nullptr)?compiler:"cc")+" -O2 -fPIC -shared -ffp-contract=off"; // No fused multiply-adds, so results match evaluate().
+	string directory;
+	cached=false;
+	if (!cache_directory("DERIVATIVE_JIT_CACHE", jit_default_cache, directory))
+		return false;
+	string source=jit_source(program);
+	char name[32];
+	snprintf(name, sizeof(name), "stack_%016llx", (unsigned long long)fnv1a_hash(command+"\n"+source));
+	string path=directory+"/"+name;
+
+	void * library=nullptr;
+	if (private_file(path+".so"))
+		library=dlopen((path+".so").c_str(), RTLD_NOW|RTLD_LOCAL);
+	cached=(library!=nullptr);
+	if (library==nullptr){ // If it has not been built before (or the file is unusable)...
+		string temporary=path+"."+to_string(getpid())+"."+to_string(hash<thread::id>()(this_thread::get_id())); // Build under a private name, so that concurrent runs (and server workers) do not see a partial file.
+		ofstream file((temporary+".c").c_str());
+		file<<source;
+		file.close();
+		if (!file)
+			return false;
+		string build=command+" -o '"+temporary+".so' '"+temporary+".c' -lm";
+		int status=system(build.c_str());
+		remove((temporary+".c").c_str());
+		if ((status!=0)||(rename((temporary+".so").c_str(), (path+".so").c_str())!=0)){
+			remove((temporary+".so").c_str());
+			return false;
+		}
+		if (private_file(path+".so"))
+			library=dlopen((path+".so").c_str(), RTLD_NOW|RTLD_LOCAL);
+		if (library==nullptr)
+			return false;
+	}
+	program.native=(void (*)(double, double, double *))dlsym(library, "derivative_stack"); // The library stays loaded for the rest of the run.
+	return program.native!=nullptr;
+}
+
+
+// FUNCTION - dx Native
+
+// Function handle passed to Taylor function in place of dx when the derivatives have been compiled to machine code. The
+// first call at a new (x,t) computes every expression at once, and later calls at the same point read the stored values.
+// The machine code works in double, so other scalar types are rounded to double and back.
+template<class scalar> scalar dx_native(scalar t, scalar x, const compiled_derivatives & program, int index, basic_evaluation_scratch<scalar> & scratch){
+	if (!scratch.stack_valid||(double(x)!=scratch.stack_x)||(double(t)!=scratch.stack_t)){ // If the stack was computed at another point...
+		program.native(double(x), double(t), &scratch.stack[0]);
+		scratch.native_runs++;
+		scratch.stack_x=double(x);
+		scratch.stack_t=double(t);
+		scratch.stack_valid=true;
+	}
+	return scalar(scratch.stack[index]);
+}
+
+// END JIT FUNCTIONS
+
+
+
+// START OUTPUT FUNCTIONS
+
+
+// Magic number at the start of a binary result file, followed by the number of columns as a 64-bit integer. The rest of
+// the file is a sequence of blocks. Each block is a 64-bit row count r, followed by r values of t, r values of the exact
+// solution, r values of x and r values of the error, all as doubles.
+const char result_magic[8]={'T','A','Y','L','O','R','R','1'};
+const uint64_t result_columns=4;
 
-// Structure that holds information about terms in a product or quotient. It can contain up to two terms
-// only, because when differentiating a product/quotient, we consider only two terms at a time, and if
-// either is itself a product/quotient, we differentiate that again in a further step. For example, for
-// f(t)=x(t)y(t)z(t), we consider the two terms x(t) and y(t)z(t), and then further consider y(t) and
-// z(t) in a subsequent step.
-struct terms_product_quotient{
-	vector<string> terms; // vector holding the multiplied/divided terms
-	int index; // int holding the index of the * or / term
-	char symbol; // character (* or /) at the index
+
+// FUNCTION - Open Sink
+
+// Opens 'fout' for output in the given format. 'reverse' is true if rows will be given in order of decreasing t.
+// Returns false if the file cannot be created.
+bool open_sink(result_sink & sink, const char * fout, output_format format, bool reverse, int display_every){
+	sink.file=fopen(fout, "wb");
+	if (sink.file==nullptr){
+		cout<<"error: could not open "<<fout<<endl;
+		return false;
+	}
+	setvbuf(sink.file, nullptr, _IONBF, 0); // Writes are already made in large blocks.
+	sink.format=format;
+	sink.reverse=reverse;
+	sink.display_every=display_every;
+	sink.spill=nullptr;
+	sink.spilled=0;
+	sink.failed=false;
+	sink.written=0;
+	sink.rows.resize(sink_rows);
+	sink.count=0;
+	sink.text.resize(sink_text_bytes);
+	sink.text_length=0;
+	if (format==BINARY_FORMAT){
+		sink.columns.resize(result_columns*sink_rows);
+		fwrite(result_magic, 1, sizeof(result_magic), sink.file);
+		fwrite(&result_columns, sizeof(result_columns), 1, sink.file);
+	}
+	return true;
+}
+
+
+// FUNCTION - Sink Row
+
+// Adds one row to the sink, writing (or spilling) the buffered rows once the buffer is full.
+void sink_row(result_sink & sink, double t, double exact, double x){
+	result_row & row=sink.rows[sink.count++];
+	row.t=t;
+	row.exact=exact;
+	row.x=x;
+	row.error=fabs(exact - x);
+	if (sink.count==sink_rows)
+		flush_sink_rows(sink);
+}
+
+
+// FUNCTION - Flush Sink Rows
+
+// Empties the row buffer. Rows of a forward run are written to the output file; rows of a backward run are appended to
+// the spill file, to be written in reverse when the sink is closed. If no spill file can be created, the rows of a
+// backward run are written as they come, in order of decreasing t; if one cannot be written, later rows are dropped.
+void flush_sink_rows(result_sink & sink){
+	if (sink.count==0)
+		return;
+	if (sink.reverse&&(sink.spill==nullptr)&&((sink.spill=tmpfile())==nullptr)){
+		cout<<"warning: could not create a temporary file; the rows of this backward run are written in order of decreasing t"<<endl;
+		sink.reverse=false;
+	}
+	if (!sink.reverse)
+		write_rows(sink, &sink.rows[0], sink.count);
+	else if (!sink.failed){
+		if (fwrite(&sink.rows[0], sizeof(result_row), sink.count, sink.spill)==sink.count)
+			sink.spilled++;
+		else {
+			cout<<"error: could not write to the temporary file; rows of this backward run are missing from the result file"<<endl;
+			sink.failed=true;
+		}
+	}
+	sink.count=0;
+}
+
+
+// FUNCTION - Write Rows
+
+// Writes 'count' rows, in order, to the output file, and shows every display_every'th one on cout. Text rows are
+// formatted as before (t, exact, Taylor and error, with default stream precision); binary rows become one block.
+void write_rows(result_sink & sink, result_row * rows, int count){
+	for (int i=0; i<count; i++) // For each row...
+		if ((sink.display_every>0)&&((sink.written+i)%sink.display_every==0)) // If t=1.00, 1.10, etc
+			display_row(rows[i]);
+	sink.written+=count;
+	if (sink.format==TEXT_FORMAT){
+		for (int i=0; i<count; i++){ // For each row...
+			if (sink.text_length+128>sink_text_bytes){ // If the buffer might not have room for it...
+				fwrite(&sink.text[0], 1, sink.text_length, sink.file);
+				sink.text_length=0;
+			}
+			sink.text_length+=snprintf(&sink.text[sink.text_length], 128, "%g %g %g %g \n", rows[i].t, rows[i].exact, rows[i].x, rows[i].error);
+		}
+	} else {
+		uint64_t block_rows=count;
+		for (int i=0; i<count; i++){ // Arrange rows by column.
+			sink.columns[i]=rows[i].t;
+			sink.columns[count+i]=rows[i].exact;
+			sink.columns[2*count+i]=rows[i].x;
+			sink.columns[3*count+i]=rows[i].error;
+		}
+		fwrite(&block_rows, sizeof(block_rows), 1, sink.file);
+		fwrite(&sink.columns[0], sizeof(double), result_columns*count, sink.file);
+	}
+}
+
+
+// FUNCTION - Display Row
+
+// Shows one row on the standard output, in the table printed by taylor().
+void display_row(const result_row & row){
+	cout << fixed;
+	cout << setprecision(2);
+	cout.width(6); cout << ((abs(row.t) < 0.0005)? 0.000: row.t)<<" ";
+	cout << fixed;
+	cout << setprecision(13);
+	cout.width(18); cout<<row.exact<<" ";
+	cout.width(18); cout<<row.x<<" ";
+	cout.width(18); cout<<row.error;
+	cout<<"\n";
+}
+
+
+// FUNCTION - Close Sink
+
+// Writes any rows still held by the sink and closes the output file. For a backward run, the rows in memory are the last
+// ones computed, so they are written first, followed by the spilled buffers from the most recent to the first.
+void close_sink(result_sink & sink){
+	if (sink.reverse){
+		reverse(sink.rows.begin(), sink.rows.begin()+sink.count);
+		write_rows(sink, &sink.rows[0], sink.count);
+		for (long k=sink.spilled-1; k>=0; k--){ // For each spilled buffer, most recent first...
+			if ((fseek(sink.spill, k*sink_rows*(long)sizeof(result_row), SEEK_SET)!=0)||(fread(&sink.rows[0], sizeof(result_row), sink_rows, sink.spill)!=sink_rows)){
+				cout<<"error: could not read back the temporary file; rows of this backward run are missing from the result file"<<endl;
+				sink.failed=true;
+				break;
+			}
+			reverse(sink.rows.begin(), sink.rows.end());
+			write_rows(sink, &sink.rows[0], sink_rows);
+		}
+		if (sink.spill!=nullptr)
+			fclose(sink.spill);
+	} else
+		flush_sink_rows(sink);
+	if (sink.text_length>0)
+		fwrite(&sink.text[0], 1, sink.text_length, sink.file);
+	fclose(sink.file);
+	sink.count=0;
+	sink.text_length=0;
+}
+
+
+// FUNCTION - Open Mapped Results
+
+// Maps a binary result file into memory and finds the start of each block. Returns false if the file cannot be opened or
+// is not a complete result file.
+bool open_mapped_results(const char * fin, mapped_results & results){
+	results.data=nullptr;
+	results.size=0;
+	results.rows=0;
+	results.first_row.clear();
+	results.block.clear();
+	results.block_rows.clear();
+	int fd=open(fin, O_RDONLY);
+	if (fd<0)
+		return false;
+	struct stat info;
+	if ((fstat(fd, &info)!=0)||(info.st_size<sizeof(result_magic)+sizeof(uint64_t))){
+		close(fd);
+		return false;
+	}
+	void * data=mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data==MAP_FAILED)
+		return false;
+	results.data=(const char *)data;
+	results.size=info.st_size;
+	uint64_t columns;
+	memcpy(&columns, results.data+sizeof(result_magic), sizeof(columns));
+	if ((memcmp(results.data, result_magic, sizeof(result_magic))!=0)||(columns!=result_columns)){
+		close_mapped_results(results);
+		return false;
+	}
+	size_t offset=sizeof(result_magic)+sizeof(uint64_t);
+	while (offset<results.size){ // For each block...
+		uint64_t rows;
+		if (offset+sizeof(rows)>results.size){
+			close_mapped_results(results);
+			return false;
+		}
+		memcpy(&rows, results.data+offset, sizeof(rows));
+		offset+=sizeof(rows);
+		if (rows>(results.size-offset)/(result_columns*sizeof(double))){ // If the block is cut short, checked before multiplying so a corrupt count cannot wrap
+			close_mapped_results(results);
+			return false;
+		}
+		results.first_row.push_back(results.rows);
+		results.block.push_back((const double *)(results.data+offset));
+		results.block_rows.push_back(rows);
+		results.rows+=rows;
+		offset+=rows*result_columns*sizeof(double);
+	}
+	return true;
+}
+
+
+// FUNCTION - Mapped Value
+
+// Returns column 'column' (0 for t, 1 for exact, 2 for x, 3 for error) of row 'row' of a mapped result file.
+double mapped_value(const mapped_results & results, long row, int column){
+	int k=upper_bound(results.first_row.begin(), results.first_row.end(), row)-results.first_row.begin()-1; // Block holding the row
+	return results.block[k][column*results.block_rows[k]+(row-results.first_row[k])];
+}
+
+
+// FUNCTION - Close Mapped Results
+
+// Unmaps a result file opened by open_mapped_results.
+void close_mapped_results(mapped_results & results){
+	if (results.data!=nullptr)
+		munmap((void *)results.data, results.size);
+	results.data=nullptr;
+	results.size=0;
+}
+
+
+// FUNCTION - Print Results
+
+// Prints the rows of a binary result file as text, in the same form as the text output of taylor().
+int print_results(const char * fin){
+	mapped_results results;
+	if (!open_mapped_results(fin, results)){
+		cout<<"error: could not read "<<fin<<endl;
+		return 1;
+	}
+	for (long i=0; i<results.rows; i++) // For each row...
+		printf("%g %g %g %g \n", mapped_value(results, i, 0), mapped_value(results, i, 1), mapped_value(results, i, 2), mapped_value(results, i, 3));
+	close_mapped_results(results);
+	return 0;
+}
+
+// END OUTPUT FUNCTIONS
+
+
+
+// START TRACE FUNCTIONS
+
+
+// FUNCTION - Open Trace
+
+// Opens the trace file 'fout' for writing, or returns null (tracing disabled) if 'fout' is null or cannot be opened.
+trace_log * open_trace(const char * fout){
+	if (fout==nullptr)
+		return nullptr;
+	FILE * file=fopen(fout, "w");
+	if (file==nullptr){
+		cerr<<"warning: could not open trace file "<<fout<<endl;
+		return nullptr;
+	}
+	trace_log * trace=new trace_log;
+	trace->file=file;
+	trace->start=chrono::steady_clock::now();
+	return trace;
+}
+
+// Trace written by this process, or null if tracing is disabled. It is opened once, before main() runs.
+trace_log * active_trace=open_trace(getenv("DERIVATIVE_TRACE"));
+
+
+// FUNCTION - Elapsed ns
+
+// Returns the time since 'start' in nanoseconds.
+double elapsed_ns(chrono::steady_clock::time_point start){
+	return chrono::duration<double, nano>(chrono::steady_clock::now()-start).count();
+}
+
+
+// FUNCTION - Write Trace
+
+// Writes one event, given as the fields of a JSON object without the braces, to the trace, adding the time since
+// tracing began. The line is flushed at once, so that the trace of a run that is stopped early is still readable.
+void write_trace(const string & fields){
+	lock_guard<mutex> guard(active_trace->lock);
+	fprintf(active_trace->file, "{\"time_ns\": %.0f, %s}\n", elapsed_ns(active_trace->start), fields.c_str());
+	fflush(active_trace->file);
+}
+
+
+// FUNCTION - Traced Derivative
+
+// Same as output_derivative, but when tracing is enabled, also records for derivative 'order' of x the size of the DAG
+// before and after simplifying, the length of its string, the time spent differentiating and simplifying, and the
+// derivative cache hits and misses for this order.
+const expression_node * traced_derivative(const expression_node * expression, expression_pool & pool, derivative_cache & cache, int order){
+	if (active_trace==nullptr)
+		return output_derivative(expression, pool, cache);
+	long hits=cache.hits, misses=cache.misses;
+	chrono::steady_clock::time_point start=chrono::steady_clock::now();
+	int form=polynomial_form(expression, cache);
+	const expression_node * derivative=(form>=0)?differentiate_polynomial(form, pool, cache):differentiate(expression, pool, cache);
+	double differentiate_ns=elapsed_ns(start);
+	start=chrono::steady_clock::now();
+	const expression_node * simplified=simplify(derivative, pool, cache.simplified);
+	double simplify_ns=elapsed_ns(start);
+	unordered_set<const expression_node *> before, after;
+	ostringstream fields;
+	fields<<"\"event\": \"derivative\", \"order\": "<<order;
+	fields<<", \"nodes_before_simplify\": "<<count_nodes(derivative, before)<<", \"nodes_after_simplify\": "<<count_nodes(simplified, after);
+	fields<<", \"string_length\": "<<expression_to_string(simplified).length();
+	fields<<", \"differentiate_ns\": "<<long(differentiate_ns)<<", \"simplify_ns\": "<<long(simplify_ns);
+	fields<<", \"cache_hits\": "<<cache.hits-hits<<", \"cache_misses\": "<<cache.misses-misses;
+	fields<<", \"pool_nodes\": "<<pool.index.size();
+	write_trace(fields.str());
+	return simplified;
+}
+
+
+// FUNCTION - Trace Taylor
+
+// Records one run of taylor(): the number of steps, the time per step, and the number of times each expression (or the
+// machine code) was run, in total and per step. The jet engine does not run the expressions of higher derivatives.
+void trace_taylor(const vector<long> & runs, long native_runs, coefficient_engine engine, int number_of_terms, const step_control & control, double total_ns){
+	long steps=max(control.accepted, 1L);
+	ostringstream fields;
+	fields<<"\"event\": \"taylor\", \"engine\": \""<<((engine==SYMBOLIC_ENGINE)?"symbolic":((engine==JET_ENGINE)?"jet":"native"))<<"\"";
+	fields<<", \"terms\": "<<number_of_terms<<", \"steps\": "<<control.accepted<<", \"rejected\": "<<control.rejected;
+	fields<<", \"total_ns\": "<<long(total_ns)<<", \"ns_per_step\": "<<setprecision(6)<<total_ns/steps;
+	fields<<", \"native_runs\": "<<native_runs<<", \"expression_runs\": [";
+	for (int i=0; i<runs.size(); i++)
+		fields<<((i>0)?", ":"")<<runs[i];
+	fields<<"], \"expression_runs_per_step\": [";
+	for (int i=0; i<runs.size(); i++)
+		fields<<((i>0)?", ":"")<<double(runs[i])/steps;
+	fields<<"]";
+	write_trace(fields.str());
+}
+
+// END TRACE FUNCTIONS
+
+
+
+// START PROGRAM CACHE FUNCTIONS
+
+// A compiled program is kept in $DERIVATIVE_PROGRAM_CACHE (or program_default_cache in the user's cache directory, made
+// as for native code by cache_directory), in a file named by a hash of its
+// key: the input function, the exact solution, the number of terms and whether the higher terms were compiled (they are
+// not for the jet engine). Setting DERIVATIVE_PROGRAM_CACHE to an empty string turns the cache off. A file holds:
+//   program_magic, then the format version and the length of the key as 32-bit integers, then the key, padded with
+//   zeros to a multiple of 8 bytes;
+//   the number of expressions and of registers, as 64-bit integers;
+//   for each expression, its number of instructions and its offset, as 64-bit integers;
+//   every instruction, in order, as a stored_instruction.
+// The key is stored in full and compared on loading, so two keys with the same hash cannot be confused, and a file of
+// another version is ignored and replaced. Files are read with mmap, so loading costs one copy of the instructions. A
+// file is only read if it and its directory belong to this user and no one else can write to them, and every count and
+// index in it is checked before it is used.
+const char * program_default_cache="derivative_program_cache";
+const char program_magic[8]={'D','E','R','I','V','P','R','G'};
+const uint32_t program_format_version=1;
+
+struct stored_instruction{
+	int32_t type, left, right, order, symbol, unused; // fields of an instruction, as in 'instruction'
+	double value; // value of a CONSTANT
 };
 
 
-//////////
+// FUNCTION - Program Cache Path
+
+// Returns the file in which the program for 'key' is kept, or an empty string if the cache is turned off or its
+// directory is not private to this user.
+string program_cache_path(const string & key){
+	const char * setting=getenv("DERIVATIVE_PROGRAM_CACHE");
+	string directory;
+	if (((setting!=nullptr)&&(setting[0]=='\0'))||!cache_directory("DERIVATIVE_PROGRAM_CACHE", program_default_cache, directory))
+		return "";
+	char name[40];
+	snprintf(name, sizeof(name), "program_%016llx.bin", (unsigned long long)fnv1a_hash(key));
+	return directory+"/"+name;
+}
+
+
+// FUNCTION - Save Program
+
+// Writes 'program' to the cache under 'key'. The file is written under a private name and then renamed, so that
+// concurrent runs never see a partial file. Returns false if it cannot be written.
+bool save_program(const string & key, const compiled_derivatives & program){
+	string path=program_cache_path(key);
+	if (path.empty())
+		return false;
+	string temporary=path+"."+to_string(getpid())+"."+to_string(hash<thread::id>()(this_thread::get_id())); // Private to this thread, since server workers may save the same program at once.
+	FILE * file=fopen(temporary.c_str(), "wb");
+	if (file==nullptr)
+		return false;
+	uint32_t header[2]={program_format_version, (uint32_t)key.length()};
+	uint64_t counts[2]={program.expressions.size(), (uint64_t)program.registers};
+	char padding[8]={0};
+	fwrite(program_magic, 1, sizeof(program_magic), file);
+	fwrite(header, sizeof(uint32_t), 2, file);
+	fwrite(key.data(), 1, key.length(), file);
+	fwrite(padding, 1, (8-key.length()%8)%8, file);
+	fwrite(counts, sizeof(uint64_t), 2, file);
+	for (int i=0; i<program.expressions.size(); i++){ // For each expression...
+		uint64_t table[2]={program.expressions[i].code.size(), (uint64_t)program.expressions[i].offset};
+		fwrite(table, sizeof(uint64_t), 2, file);
+	}
+	for (int i=0; i<program.expressions.size(); i++){
+		for (int j=0; j<program.expressions[i].code.size(); j++){ // For each instruction...
+			const instruction & step=program.expressions[i].code[j];
+			stored_instruction stored={step.type, step.left, step.right, step.order, step.symbol, 0, step.value};
+			fwrite(&stored, sizeof(stored), 1, file);
+		}
+	}
+	bool written=(ferror(file)==0);
+	if ((fclose(file)!=0)||!written||(rename(temporary.c_str(), path.c_str())!=0)){
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+// FUNCTION - Load Program
+
+// Reads the program kept in the cache under 'key' into 'program', which must have 'expressions' expressions and refer
+// to symbols 0 to symbols-1 only. Returns false if there is none, or if the file is not private to this user, is of
+// another version, was saved under another key, is cut short, has another number of expressions or registers, or holds
+// an instruction that reads a register or derivative not yet written, or an unknown symbol.
+bool load_program(const string & key, int expressions, int symbols, compiled_derivatives & program){
+	string path=program_cache_path(key);
+	if (path.empty()||!private_file(path))
+		return false;
+	int fd=open(path.c_str(), O_RDONLY|O_NOFOLLOW);
+	if (fd<0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info)!=0){
+		close(fd);
+		return false;
+	}
+	size_t size=info.st_size;
+	size_t head=sizeof(program_magic)+2*sizeof(uint32_t);
+	if (size<head){
+		close(fd);
+		return false;
+	}
+	void * data=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data==MAP_FAILED)
+		return false;
+	const char * bytes=(const char *)data;
+	uint32_t header[2];
+	memcpy(header, bytes+sizeof(program_magic), sizeof(header));
+	size_t offset=head+key.length()+(8-key.length()%8)%8;
+	bool valid=(memcmp(bytes, program_magic, sizeof(program_magic))==0)&&(header[0]==program_format_version)&&(header[1]==key.length());
+	valid=valid&&(offset+2*sizeof(uint64_t)<=size)&&(memcmp(bytes+head, key.data(), key.length())==0);
+	uint64_t counts[2]={0, 0};
+	if (valid){
+		memcpy(counts, bytes+offset, sizeof(counts));
+		offset+=sizeof(counts);
+		valid=(counts[0]==(uint64_t)expressions)&&(counts[0]<=(size-offset)/(2*sizeof(uint64_t)));
+	}
+	const char * table=bytes+offset;
+	offset+=counts[0]*2*sizeof(uint64_t);
+	uint64_t total=0; // Number of instructions in all expressions
+	for (uint64_t i=0; valid&&(i<counts[0]); i++){ // For each expression...
+		uint64_t entry[2];
+		memcpy(entry, table+i*sizeof(entry), sizeof(entry));
+		total+=entry[0];
+		valid=(entry[0]<=(size-offset)/sizeof(stored_instruction))&&(entry[0]<=counts[1])&&(entry[1]<=counts[1]-entry[0]);
+	}
+	valid=valid&&(total<=(size-offset)/sizeof(stored_instruction))&&(total==counts[1]); // Registers are numbered through all expressions
+	if (valid){
+		program.expressions.assign(counts[0], compiled_expression());
+		program.registers=counts[1];
+		program.native=nullptr;
+		const char * stored=bytes+offset;
+		for (uint64_t i=0; valid&&(i<counts[0]); i++){ // For each expression...
+			uint64_t entry[2];
+			memcpy(entry, table+i*sizeof(entry), sizeof(entry));
+			compiled_expression & expression=program.expressions[i];
+			expression.offset=entry[1];
+			expression.code.resize(entry[0]);
+			for (uint64_t j=0; valid&&(j<entry[0]); j++){ // For each instruction...
+				stored_instruction step;
+				memcpy(&step, stored, sizeof(step));
+				stored+=sizeof(step);
+				bool binary=((step.type>=ADD)&&(step.type<=DIVIDE))||(step.type==POWER);
+				valid=(step.type>=CONSTANT)&&(step.type<=TANGENT)&&(step.left<(int64_t)j)&&(step.right<(int64_t)j)&&(step.order>=0)&&(step.order<=i);
+				valid=valid&&(step.left>=((step.type>=ADD)?0:-1))&&(step.right>=(binary?0:-1)); // Operators must have their operands
+				valid=valid&&(step.symbol>=0)&&(step.symbol<symbols);
+				instruction & target=expression.code[j];
+				target.type=(node_type)step.type;
+				target.left=step.left;
+				target.right=step.right;
+				target.value=step.value;
+				target.order=step.order;
+				target.symbol=step.symbol;
+			}
+		}
+	}
+	munmap(data, size);
+	return valid;
+}
+
+
+// FUNCTION - Compile Function
+
+// Starts 'sequence' from 'function' and fills 'program' as compile_sequence does, but takes the program from the cache
+// when an earlier run has already compiled the same function, exact solution and number of terms, and otherwise saves
+// it there. Only x' is parsed when the cache is used; higher terms of 'sequence' are still made if they are asked for,
+// such as when the order is raised. Returns false if 'function' or 'exact' cannot be used.
+bool compile_function(derivative_sequence & sequence, const string & function, const string & exact, int number_of_terms, coefficient_engine engine, compiled_derivatives & program){
+	chrono::steady_clock::time_point start=chrono::steady_clock::now();
+	parse_error error;
+	if (!start_sequence(sequence, function, error)){
+		cout<<"error: "<<describe_parse_error(function, error)<<endl;
+		return false;
+	}
+	string key=function+"\n"+exact+"\n"+to_string(number_of_terms)+"\n"+((engine==JET_ENGINE)?"x' only":"all terms");
+	bool cached=load_program(key, number_of_terms+1, sequence.pool.symbols.size(), program);
+	if (!cached){
+		if (!compile_sequence(sequence, exact, number_of_terms, engine, program))
+			return false;
+		save_program(key, program);
+	}
+	if (active_trace!=nullptr)
+		write_trace("\"event\": \"program_cache\", \"hit\": "+string(cached?"true":"false")+", \"instructions\": "+to_string(program.registers)+", \"ns\": "+to_string(long(elapsed_ns(start))));
+	return true;
+}
+
+// END PROGRAM CACHE FUNCTIONS
+
+
+
+// START OF TAYLOR METHOD FUNCTIONS
+
+
+// FUNCTION - dx
+
+// Function handle passed to Taylor function that runs the compiled expression for one entry of symbolic_derivatives.
+// Derivatives already found at (x,t) are reused.
+template<class scalar> scalar dx(scalar t, scalar x, const compiled_derivatives & program, int index, basic_evaluation_scratch<scalar> & scratch){
+	return derivative_value(program, index, scratch, x, t);
+}
+
+
+// FUNCTION - Taylor Values
+
+// Fills 'values' with what is needed to sum the Taylor series of x about (x,t). With JET_ENGINE, values[k] is the
+// coefficient of h^k; otherwise, values[j] is derivative j+1 of x, found with the function handle x1 (dx, or dx_native
+// for machine code). 'values' must have room for number_of_terms+1 doubles, and 'scratch' (or 'jets', for the jet
+// engine) must have been prepared for 'program'.
+template<class scalar> void taylor_values(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, basic_evaluation_scratch<scalar> & scratch, basic_jet_scratch<scalar> & jets, scalar * values, scalar x, scalar t){
+	if (engine==JET_ENGINE)
+		taylor_coefficients(program, jets, x, t, number_of_terms, values);
+	else
+		for (int j=0; j<number_of_terms; j++)
+			values[j]=x1(t, x, program, j, scratch);
+}
+
+
+// FUNCTION - Sum Taylor Series
+
+// Returns the change in x over a step of width h, found by summing the Taylor series in 'values' with Horner's rule. A
+// negative h steps backward in t.
+template<class scalar> scalar sum_taylor_series(const scalar * values, int number_of_terms, coefficient_engine engine, scalar h){
+	scalar p;
+	if (engine==JET_ENGINE){
+		p=values[number_of_terms]*h;
+		for (int k=number_of_terms-1; k>=1; k--)
+			p=(p+values[k])*h;
+	} else {
+		p=values[number_of_terms-1]*h/number_of_terms;
+		for (int k=number_of_terms; k>=2; k--)
+			p=(p+values[k-2])*h/(k-1);
+	}
+	return p;
+}
+
+
+// FUNCTION - Last Taylor Term
+
+// Returns the size of the last term of the Taylor series for a step of width h. This is the first term of the series left
+// out by a method with one term fewer, and is used as the estimate of the local truncation error.
+template<class scalar> scalar last_taylor_term(const scalar * values, int number_of_terms, coefficient_engine engine, scalar h){
+	scalar term=(engine==JET_ENGINE)?values[number_of_terms]:values[number_of_terms-1];
+	for (int k=1; k<=number_of_terms; k++)
+		term*=(engine==JET_ENGINE)?h:h/k;
+	return fabs(term);
+}
+
+
+// FUNCTION - Step Factor
+
+// Returns the factor by which to scale a step whose error estimate is 'error', so that the next estimate is a little
+// below 'tolerance'. The error of the last term grows as h^number_of_terms.
+double step_factor(double error, double tolerance, int number_of_terms){
+	if (error==0)
+		return step_max_factor;
+	return min(step_max_factor, max(step_min_factor, step_safety*pow(tolerance/error, 1.0/number_of_terms)));
+}
+
+
+// FUNCTION - Taylor Coefficient
+
+// Returns coefficient k of the Taylor series in 'values' (the coefficient of h^k), for k from 1 to number_of_terms.
+template<class scalar> scalar taylor_coefficient(const scalar * values, int k, coefficient_engine engine){
+	if (engine==JET_ENGINE)
+		return values[k];
+	scalar coefficient=values[k-1];
+	for (int j=2; j<=k; j++)
+		coefficient/=j;
+	return coefficient;
+}
+
+
+// FUNCTION - Worth Raising Order
+
+// Returns true if a step with one more Taylor term is expected to cover more of the interval per unit of work than a
+// step with number_of_terms terms. The step each order allows is found from its last term, as in adaptive mode, with the
+// next coefficient estimated from the ratio of the last two. The work is the number of instructions run per step: the
+// symbolic derivatives up to that order, with the size of the next one estimated from the growth of the last two, or
+// for the jet engine, number_of_terms^2 coefficient updates of x'.
+template<class scalar> bool worth_raising_order(const scalar * values, int number_of_terms, coefficient_engine engine, const compiled_derivatives & program, double tolerance){
+	int p=number_of_terms;
+	if (p<2)
+		return false;
+	double last=double(fabs(taylor_coefficient(values, p, engine)));
+	double previous=double(fabs(taylor_coefficient(values, p-1, engine)));
+	if ((last==0)||(previous==0)) // If the series ends here, more terms cannot help.
+		return false;
+	double next=last*last/previous;
+	double h=pow(tolerance/last, 1.0/p), h_next=pow(tolerance/next, 1.0/(p+1));
+	double work, next_work;
+	if (engine==JET_ENGINE){
+		work=double(p)*p;
+		next_work=double(p+1)*(p+1);
+	} else {
+		work=0;
+		for (int i=0; i<p; i++)
+			work+=program.expressions[i].code.size();
+		double size=program.expressions[p-1].code.size(), before=program.expressions[p-2].code.size();
+		next_work=work+size*size/before;
+	}
+	return h_next/next_work>h/work;
+}
+
+
+// FUNCTION - Taylor Increment
+
+// Returns the change in x over one step of width h from (x,t). A negative h steps backward in t.
+template<class scalar> scalar taylor_increment(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, basic_evaluation_scratch<scalar> & scratch, basic_jet_scratch<scalar> & jets, scalar * values, scalar x, scalar t, scalar h){
+	taylor_values(x1, program, number_of_terms, engine, scratch, jets, values, x, t);
+	return sum_taylor_series(values, number_of_terms, engine, h);
+}
+
+
+// FUNCTION - Taylor
+
+// Implements Taylor Method. With SYMBOLIC_ENGINE (or NATIVE_ENGINE) the derivatives at each step are found from the
+// symbolic derivatives x', x'', etc, through x1; with JET_ENGINE the Taylor coefficients are found from x' alone by
+// taylor_coefficients().
+// Results are streamed to 'fout' in the given format, in order of increasing t, using a fixed amount of memory. If
+// control.adaptive is set, the run covers the same interval as n fixed steps, but h is chosen at each step to meet the
+// tolerances in 'control', starting from a trial step of h. Rejected trial steps reuse the derivatives already computed
+// at (x,t), so they cost only one more sum of the series. Only the first and last rows are shown, since the rows are no
+// longer evenly spaced. If control.max_terms allows, the order is raised at the start of any step where
+// worth_raising_order expects one more term to pay for itself; the new derivatives come from control.sequence, and are
+// run by the interpreter from then on, since machine code built before the run does not include them.
+// If 'dense' is not nullptr, the Taylor polynomial of every step is also kept there (see dense_value).
+// If x stops being finite, or adaptive steps cannot meet the tolerances (see step_control), the run stops at the last
+// point reached, which is kept as the end of the output, and control.failed is set.
+template<class scalar> void taylor(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), scalar t, scalar x, scalar h, long n, int a_or_b, const char* fout, compiled_derivatives & program, int number_of_terms, coefficient_engine engine, output_format format, step_control & control, dense_solution * dense)
+  {
+    // Set up input/output
+    result_sink sink; // Output file in which we will save results.
+    if (!open_sink(sink, fout, format, a_or_b==2, control.adaptive?0:50)) // Show every 50th row, i.e. t=1.00, 1.10, etc.
+      return;
+    cout.setf(ios::left); // Left justify output
+    cout.setf(ios::showpoint); // Show decimal point
+
+    // Declare variables for holding data
+    scalar exact; // Exact solution at each iteration.
+    basic_evaluation_scratch<scalar> scratch; // Registers used when evaluating compiled expressions.
+    prepare_scratch(program, scratch);
+    vector<scalar> values(number_of_terms+1); // Derivatives or Taylor coefficients at each iteration.
+    basic_jet_scratch<scalar> jets; // Series used by the jet engine.
+    if (engine==JET_ENGINE)
+    	prepare_jet_scratch(program, number_of_terms, jets);
+
+    // Row headers
+    cout<<"\n";
+    cout.width(7); cout<<"t ";
+    cout.width(19); cout<<"Exact ";
+    cout.width(19); cout<<"Taylor ";
+    cout.width(19); cout<<"Error";
+    cout<<"\n";
+
+    // Initial values
+    exact=x1(t, x, program, number_of_terms, scratch);
+    sink_row(sink, double(t), double(exact), double(x));
+    result_row first={double(t), double(exact), double(x), double(fabs(exact - x))};
+    control.accepted=0;
+    control.rejected=0;
+    control.failed=false;
+    if (dense!=nullptr)
+      start_dense(*dense);
+    chrono::steady_clock::time_point start=chrono::steady_clock::now(); // Start of the steps, for the trace.
+
+    // Perform iterations of Taylor method
+    scalar step=(a_or_b==1)?h:-h; // Backward Taylor method expands the series in the -h direction.
+    if (!control.adaptive)
+    {
+      for (long i = 1; i <= n; i++)
+      {
+        scalar increment=taylor_increment(x1, program, number_of_terms, engine, scratch, jets, &values[0], x, t, step);
+        if (!isfinite(double(x+increment))) // If the solution has blown up, stop here rather than write infinities.
+        {
+          control.failed=true;
+          break;
+        }
+        if (dense!=nullptr)
+          dense_step(*dense, &values[0], number_of_terms, engine, x, t);
+        x += increment;
+        t += step;
+        control.accepted++;
+        // Compute and save next set of values
+        exact=x1(t, x, program, number_of_terms, scratch);
+        sink_row(sink, double(t), double(exact), double(x));
+      }
+    } else
+    {
+      scalar t_end=t+scalar(n)*step;
+      while (double(fabs(t_end-t)) > 1e-12*max(1.0, double(fabs(t_end)))) // Until the end of the interval is reached...
+      {
+        taylor_values(x1, program, number_of_terms, engine, scratch, jets, &values[0], x, t);
+        double tolerance=control.absolute_tolerance+control.relative_tolerance*double(fabs(x));
+        while ((number_of_terms<control.max_terms)&&worth_raising_order(&values[0], number_of_terms, engine, program, tolerance))
+        {
+          number_of_terms++;
+          grow_compiled(*control.sequence, number_of_terms, engine, program);
+          resize_scratch(program, scratch);
+          values.resize(number_of_terms+1);
+          if (engine==JET_ENGINE)
+            prepare_jet_scratch(program, number_of_terms, jets);
+          x1=dx<scalar>;
+          taylor_values(x1, program, number_of_terms, engine, scratch, jets, &values[0], x, t); // Lower derivatives are reused.
+        }
+        bool last=false;
+        int rejections=0; // Trial steps rejected in a row
+        for (;;) // Until a trial step is accepted, or the run is given up...
+        {
+          if (fabs(step)>=fabs(t_end-t)) // Do not step past the end of the interval.
+          {
+            step=t_end-t;
+            last=true;
+          }
+          double error=double(last_taylor_term(&values[0], number_of_terms, engine, step));
+          double factor=step_factor(error, tolerance, number_of_terms);
+          if (isnan(error)) // The derivatives themselves are not finite, so no step can meet the tolerance.
+          {
+            control.failed=true;
+            break;
+          }
+          if (error<=tolerance)
+          {
+            scalar increment=sum_taylor_series(&values[0], number_of_terms, engine, step);
+            if (!isfinite(double(x+increment)))
+            {
+              control.failed=true;
+              break;
+            }
+            if (dense!=nullptr)
+              dense_step(*dense, &values[0], number_of_terms, engine, x, t);
+            x += increment;
+            t = last? t_end: t+step;
+            control.accepted++;
+            step*=scalar(factor); // Next trial step.
+            break;
+          }
+          control.rejected++;
+          step*=scalar(factor);
+          last=false;
+          if ((++rejections>control.max_rejections)||(double(fabs(step))<control.min_step*max(1.0, double(fabs(t)))))
+          {
+            control.failed=true;
+            break;
+          }
+        }
+        if (control.failed)
+          break;
+        // Compute and save next set of values
+        exact=x1(t, x, program, number_of_terms, scratch);
+        sink_row(sink, double(t), double(exact), double(x));
+      }
+    }
+
+    // Write remaining values. A backward run is written, and displayed, in order of increasing t.
+    control.terms=number_of_terms;
+    if (control.failed)
+    {
+      control.failed_at=double(t);
+      cout<<"error: the solution could not be continued past t="<<double(t)<<" (x="<<double(x)<<"); it may have a singularity there"<<endl;
+    }
+    if (dense!=nullptr)
+      finish_dense(*dense, double(t), a_or_b==2);
+    if (active_trace!=nullptr)
+      trace_taylor(scratch.runs, scratch.native_runs, engine, number_of_terms, control, elapsed_ns(start));
+    close_sink(sink);
+    if (control.adaptive) // Show the end points of the run.
+    {
+      result_row end={double(t), double(exact), double(x), double(fabs(exact - x))};
+      display_row((a_or_b==1)? first: end);
+      display_row((a_or_b==1)? end: first);
+    }
+    return;
+  }
+
+
+// FUNCTION - Solve Problem
+
+// Solves Problem from Final Project, now using symbolic derivatives rather than user-defined derivatives. The derivatives
+// are parsed and compiled once here, before any steps are taken. Results are saved to solve_problem.dat, or to
+// solve_problem.bin in the binary format. With control.adaptive set, h is not used: the first trial step is the whole
+// interval, and later steps are chosen from the error estimate. If control.max_terms also allows the order to be raised,
+// the derivatives are made from derivatives[0] as they are needed, in place of those given, or taken from the program
+// cache (see compile_function). If 'dense' is not nullptr,
+// it receives the Taylor polynomial of every step, for finding x between grid points. Returns 1 if the derivatives
+// cannot be used or the run was given up before b (see step_control), and 0 otherwise.
+int solve_problem(const vector<string> & derivatives, int number_of_terms, double h, double a, double b, double xa, int forward_backward, coefficient_engine engine, output_format format, step_control & control, dense_solution * dense)
+{
+	int start_s=clock();
+
+    compiled_derivatives program;
+    derivative_sequence sequence;
+    chrono::steady_clock::time_point phase=chrono::steady_clock::now();
+    control.sequence=nullptr;
+    if (control.adaptive&&(control.max_terms>number_of_terms)) // If the order may be raised...
+    {
+    	if (!compile_function(sequence, derivatives[0], (derivatives.size()>number_of_terms)?derivatives.back():"", number_of_terms, engine, program))
+    		return 1;
+    	control.sequence=&sequence;
+    }
+    else if (!compile_derivatives(derivatives, number_of_terms, program))
+    	return 1;
+    if (active_trace!=nullptr)
+    	write_trace("\"event\": \"compile\", \"expressions\": "+to_string(program.expressions.size())+", \"instructions\": "+to_string(program.registers)+", \"ns\": "+to_string(long(elapsed_ns(phase))));
+    bool cached;
+    phase=chrono::steady_clock::now();
+    if ((engine==NATIVE_ENGINE)&&!jit_compile(program, cached)) // If machine code cannot be built, run the compiled expressions instead.
+    	cout<<"warning: could not compile derivatives to machine code; evaluating them instead"<<endl;
+    if ((engine==NATIVE_ENGINE)&&(active_trace!=nullptr))
+    	write_trace("\"event\": \"jit\", \"built\": "+string((program.native!=nullptr)?"true":"false")+", \"cached\": "+string(((program.native!=nullptr)&&cached)?"true":"false")+", \"ns\": "+to_string(long(elapsed_ns(phase))));
+
+    // Define constants
+    double t;
+    if (forward_backward==1)
+    	t=a;
+    else
+    	t=b;
+    long n = (b - a) / h;
+    if (control.adaptive) // Cover exactly [a,b] in one "step", which taylor() divides up.
+    {
+      n = 1;
+      h = b - a;
+    }
+
+    // Execute Taylor Method
+    taylor((program.native!=nullptr)?dx_native<double>:dx<double>, t, xa, h, n, forward_backward, (format==BINARY_FORMAT)?"solve_problem.bin":"solve_problem.dat", program, number_of_terms, engine, format, control, dense);
+    int stop_s=clock();
+    if (control.adaptive)
+    	cout<<endl<<"steps: "<<control.accepted<<" accepted, "<<control.rejected<<" rejected";
+    if (control.terms>number_of_terms)
+    	cout<<", order raised to "<<control.terms<<" terms";
+    cout<<endl<<"runtime: "<<(stop_s-start_s)/double(CLOCKS_PER_SEC)*1000<<" ms"<<endl;
+    return control.failed?1:0;
+}
+
+// END OF TAYLOR METHOD FUNCTIONS
+
+
+
+// START DENSE OUTPUT FUNCTIONS
+
+// In this section, the Taylor series summed at each step is kept as a polynomial, so that x(t) is known everywhere in the
+// interval to the accuracy of the method, not only at the grid points. Finding the step that holds a given t is a binary
+// search over the expansion points, and a sorted list of times is answered in one pass.
+
+
+// FUNCTION - Start Dense
+
+// Empties 'dense' before a run.
+void start_dense(dense_solution & dense){
+	dense.t.clear();
+	dense.start.assign(1, 0);
+	dense.coefficients.clear();
+	dense.backward=false;
+	dense.lower=dense.upper=0;
+}
+
+
+// FUNCTION - Dense Step
+
+// Adds the Taylor polynomial of a step from (x,t) to 'dense', from the series in 'values' that the step was summed from.
+template<class scalar> void dense_step(dense_solution & dense, const scalar * values, int number_of_terms, coefficient_engine engine, scalar x, scalar t){
+	dense.t.push_back(double(t));
+	dense.coefficients.push_back(double(x));
+	for (int k=1; k<=number_of_terms; k++)
+		dense.coefficients.push_back(double(taylor_coefficient(values, k, engine)));
+	dense.start.push_back(dense.coefficients.size());
+}
+
+
+// FUNCTION - Finish Dense
+
+// Records the end of the run, at 'end'. The steps of a backward run are put in order of increasing t.
+void finish_dense(dense_solution & dense, double end, bool backward){
+	dense.backward=backward;
+	if (dense.t.empty()){ // If no step was taken, nothing is covered but the end itself.
+		dense.lower=dense.upper=end;
+		return;
+	}
+	if (backward){
+		vector<double> coefficients;
+		vector<size_t> start(1, 0);
+		coefficients.reserve(dense.coefficients.size());
+		for (int k=dense.t.size()-1; k>=0; k--){ // For each step, from last to first...
+			coefficients.insert(coefficients.end(), dense.coefficients.begin()+dense.start[k], dense.coefficients.begin()+dense.start[k+1]);
+			start.push_back(coefficients.size());
+		}
+		reverse(dense.t.begin(), dense.t.end());
+		dense.coefficients.swap(coefficients);
+		dense.start.swap(start);
+	}
+	dense.lower=backward?end:dense.t.front();
+	dense.upper=backward?dense.t.back():end;
+}
+
+
+// FUNCTION - Dense Find
+
+// Returns the step of 'dense' that covers 'time'. Times outside the interval use the first or last step.
+int dense_find(const dense_solution & dense, double time){
+	int k;
+	if (dense.backward) // First step expanded at or after 'time'
+		k=lower_bound(dense.t.begin(), dense.t.end(), time)-dense.t.begin();
+	else // Last step expanded at or before 'time'
+		k=int(upper_bound(dense.t.begin(), dense.t.end(), time)-dense.t.begin())-1;
+	return min(max(k, 0), int(dense.t.size())-1);
+}
+
+
+// FUNCTION - Dense Polynomial
+
+// Returns the value at 'time' of the Taylor polynomial of step k, by Horner's rule.
+double dense_polynomial(const dense_solution & dense, int k, double time){
+	double s=time-dense.t[k];
+	const double * c=&dense.coefficients[dense.start[k]];
+	double p=c[dense.start[k+1]-dense.start[k]-1];
+	for (int j=dense.start[k+1]-dense.start[k]-2; j>=0; j--)
+		p=p*s+c[j];
+	return p;
+}
+
+
+// FUNCTION - Dense Value
+
+// Returns x at 'time', from the polynomial of the step that covers it, in O(log n) for n steps. 'dense' must hold at
+// least one step.
+double dense_value(const dense_solution & dense, double time){
+	return dense_polynomial(dense, dense_find(dense, time), time);
+}
+
+
+// FUNCTION - Dense Values
+
+// Sets x[i] to x at times[i], for 'count' times in increasing order. Only the first time is searched for; the step is
+// then moved forward as the times pass its end, so the cost is O(log n + count + steps covered).
+void dense_values(const dense_solution & dense, const double * times, int count, double * x){
+	if (count==0)
+		return;
+	int k=dense_find(dense, times[0]), last=dense.t.size()-1;
+	for (int i=0; i<count; i++){ // For each time...
+		if (dense.backward)
+			while ((k<last)&&(dense.t[k]<times[i]))
+				k++;
+		else
+			while ((k<last)&&(dense.t[k+1]<=times[i]))
+				k++;
+		x[i]=dense_polynomial(dense, k, times[i]);
+	}
+}
+
+// END DENSE OUTPUT FUNCTIONS
+
+
+
+// START SYSTEM FUNCTIONS
+
+// In this section, a system of N equations x1' = f1(x1,...,xN,t), ..., xN' = fN(x1,...,xN,t) is differentiated and
+// solved as a whole. Derivative k of xi' is written in terms of t and derivatives of all of x1 through xN up to order k,
+// which are the derivatives of order k-1 of the other equations, so all components are differentiated, compiled and
+// evaluated together, lowest order first.
+
+
+// FUNCTION - Name Components
+
+// Adds the symbols x1, x2, ..., xN to 'pool'. They are given the ids first, first+1, etc, and 'first' is returned.
+int name_components(int components, expression_pool & pool){
+	int first=intern_symbol(pool, "x1");
+	for (int i=2; i<=components; i++)
+		intern_symbol(pool, "x"+to_string(i));
+	return first;
+}
+
+
+// FUNCTION - System Derivatives
+
+// Parses the right-hand sides 'functions' of a system and computes number_of_terms-1 derivatives of each, in one pool
+// and with one derivative cache, so that subexpressions shared by several components are built and differentiated
+// once. derivatives[k*N+i] is derivative k of x(i+1)'. Returns false if a function cannot be parsed.
+bool system_derivatives(const vector<string> & functions, int number_of_terms, expression_pool & pool, derivative_cache & cache, vector<const expression_node *> & derivatives){
+	int components=functions.size();
+	name_components(components, pool);
+	derivatives.assign(components*number_of_terms, nullptr);
+	for (int i=0; i<components; i++){ // For each equation...
+		parse_error error;
+		const expression_node * expression=parse_expression(functions[i], pool, error);
+		if (expression==nullptr){
+			cout<<"error: "<<describe_parse_error(functions[i], error)<<endl;
+			return false;
+		}
+		derivatives[i]=simplify(expression, pool, cache.simplified);
+	}
+	for (int k=1; k<number_of_terms; k++) // For each derivative order...
+		for (int i=0; i<components; i++) // ...and each equation.
+			derivatives[k*components+i]=traced_derivative(derivatives[(k-1)*components+i], pool, cache, k+1);
+	return true;
+}
 
 
-// FUNCTION PROTOTYPES
+// FUNCTION - Compile System
+
+// Compiles all of 'derivatives' (as from system_derivatives) into one list of instructions with one map of compiled
+// nodes, so a subexpression common to several components or orders is computed once. The symbol of each VARIABLE
+// becomes the index of its component. Returns false if an expression refers to a symbol that is not a component, or
+// to a derivative that is not computed before it.
+bool compile_system(const vector<const expression_node *> & derivatives, int components, int number_of_terms, const expression_pool & pool, compiled_system & program){
+	int first=pool.symbol_ids.at("x1");
+	program.components=components;
+	program.number_of_terms=number_of_terms;
+	program.tape.code.clear();
+	program.tape.offset=0;
+	program.results.clear();
+	unordered_map<const expression_node *, int> registers;
+	for (int e=0; e<derivatives.size(); e++){ // For each expression, lowest order first...
+		int start=program.tape.code.size();
+		program.results.push_back(compile_node(derivatives[e], program.tape, registers));
+		for (int j=start; j<program.tape.code.size(); j++){ // Check the derivatives of the state this expression uses.
+			instruction & step=program.tape.code[j];
+			if (step.type!=VARIABLE)
+				continue;
+			if ((step.symbol<first)||(step.symbol>=first+components)){
+				cout<<"error: "<<pool.symbols[step.symbol]<<" is not a component of the system"<<endl;
+				return false;
+			}
+			step.symbol-=first;
+			if ((step.order>0)&&((step.order-1)*components+step.symbol>=e)){
+				cout<<"error: "<<expression_to_string(derivatives[e])<<" refers to "<<pool.symbols[step.symbol+first]+string(step.order,'\'')<<", which is not computed before it"<<endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
-// ORGANIZATION FUNCTIONS - Functions used for parsing strings into terms of a sum, difference, product, or quotient.
-terms_sum_difference break_into_plus_minus(string str);
-terms_product_quotient break_into_mult_divide(string str);
-void print_terms(terms_sum_difference);
-void print_terms(terms_product_quotient);
 
-// DERIVATIVE FUNCTIONS - Functions used for computing derivatives of functions dfined by input strings.
-string differentiate(string);
-string output_derivative(string str, vector<string> & vector, int num_terms);
-string product_rule(string, string, vector<string> &, int);
-string quotient_rule(string, string, vector<string> &, int);
-
-// CLEAN UP FUNCTIONS - Functions used to format functions defined by output (differentiated) strings to make them more easily readable.
-void clear_duplicate_symbols(string &);
-void clear_head_or_tail_symbols(string &);
-void clear_outer_brackets(string &);
-bool outer_brackets(string);
-void clear_ones(string &);
-void clear_zeros(string &);
-void clear_unnecessary_brackets(string &);
-void clean_up(string &);
+// FUNCTION - Evaluate System
+
+// Runs every instruction of 'program' once at the state x (one value per component) and time t, and sets values[k*N+i]
+// to derivative k+1 of x(i+1). 'r' must have room for the registers of the whole program.
+template<class scalar> void evaluate_system(const compiled_system & program, scalar * r, const scalar * x, scalar t, scalar * values){
+	const vector<instruction> & code=program.tape.code;
+	for (int i=0; i<code.size(); i++){ // For each instruction...
+		const instruction & step=code[i];
+		switch (step.type){
+			case CONSTANT: r[i]=scalar(step.value); break;
+			case VARIABLE: r[i]=(step.order==0)?x[step.symbol]:r[program.results[(step.order-1)*program.components+step.symbol]]; break;
+			case TIME: r[i]=t; break;
+			case ADD: r[i]=r[step.left]+r[step.right]; break;
+			case SUBTRACT: r[i]=r[step.left]-r[step.right]; break;
+			case MULTIPLY: r[i]=r[step.left]*r[step.right]; break;
+			case DIVIDE: r[i]=r[step.left]/r[step.right]; break;
+			case NEGATE: r[i]=-r[step.left]; break;
+			case EXPONENTIAL: r[i]=exp(r[step.left]); break;
+			case LOGARITHM: r[i]=log(r[step.left]); break;
+			case POWER: r[i]=pow(r[step.left], r[step.right]); break;
+			case SINE: r[i]=sin(r[step.left]); break;
+			case COSINE: r[i]=cos(r[step.left]); break;
+			case TANGENT: r[i]=tan(r[step.left]); break;
+		}
+	}
+	for (int j=0; j<program.results.size(); j++)
+		values[j]=r[program.results[j]];
+}
 
-// TAYLOR METHOD FUNCTIONS - Functions used for implementing Taylor Method. Similar to those used in Problem 1 of Final Project.
-void reverse_array(double, int);
-void taylor(double x1(double, double, string, vector<string>), double, double, double, int, int, char*, vector<string>, int);
-int solve_problem(vector<string>, int);
-double evaluate(string, vector<string>, double, double);
-double dx(double, double, string, vector<string>);
 
-///////////
+// FUNCTION - Sum Taylor System
 
+// Adds to each component of x its change over a step of width h, summing the Taylor series of all components at once
+// with Horner's rule, as in sum_taylor_series. The derivatives of one order are contiguous in 'values', so each loop
+// runs over consecutive components and can be vectorized. 'p' is scratch space for one value per component.
+template<class scalar> void sum_taylor_system(const scalar * values, int components, int number_of_terms, scalar h, scalar * p, scalar * x){
+	const scalar * last=values+(number_of_terms-1)*components;
+	for (int i=0; i<components; i++)
+		p[i]=last[i]*h/number_of_terms;
+	for (int k=number_of_terms; k>=2; k--){ // For each lower derivative...
+		const scalar * v=values+(k-2)*components;
+		for (int i=0; i<components; i++)
+			p[i]=(p[i]+v[i])*h/(k-1);
+	}
+	for (int i=0; i<components; i++)
+		x[i]+=p[i];
+}
 
-// START ORGANIZATION FUNCTIONS
 
+// FUNCTION - Write System Row
 
-// FUNCTION - Print terms
-// When a sum or difference is broken into terms, this function prints the terms, as well as the indices of + or - characters, and the characters themselves.
-void print_terms(terms_sum_difference term){
-	cout<<"Terms1: ";
-	for (vector<string>::iterator itr=term.terms.begin(); itr!=term.terms.end(); ++itr)
-		cout<<*itr<<" ";
-	cout<<endl;
-	for (vector<int>::iterator itr=term.indices.begin(); itr!=term.indices.end(); ++itr)
-		cout<<*itr<<" ";
-	cout<<endl;
-	for (vector<char>::iterator itr=term.symbols.begin(); itr!=term.symbols.end(); ++itr)
-		cout<<*itr<<" ";
-	cout<<endl;
+// Writes t and every component of x as one line of text.
+template<class scalar> void write_system_row(FILE * file, scalar t, const vector<scalar> & x){
+	fprintf(file, "%g ", double(t));
+	for (int i=0; i<x.size(); i++)
+		fprintf(file, "%g ", double(x[i]));
+	fprintf(file, "\n");
 }
 
 
-// FUNCTION - Print terms
-// When a product or quotient is broken into terms, this function prints the terms, as well as the index of the * or / character, and the character itself.
-void print_terms(terms_product_quotient term){
-	if (term.terms.size()==1)
-		cout<<"Terms2: "<<term.terms[0]<<" "<<term.index<<" "<<term.symbol<<endl;
-	else
-		cout<<"Terms2: "<<term.terms[0]<<" "<<term.terms[1]<<" "<<term.index<<" "<<term.symbol<<endl;
+// FUNCTION - Taylor System
+
+// Implements the Taylor method for a system: n steps of width h from (t, x), forward if a_or_b is 1 and backward if it
+// is 2. Every row is written to 'file' in the order it is computed. The state, the derivatives and the Horner sums are
+// kept in arrays allocated once, so a step allocates no memory.
+template<class scalar> void taylor_system(const compiled_system & program, scalar t, vector<scalar> & x, scalar h, long n, int a_or_b, FILE * file){
+	vector<scalar> registers(program.tape.code.size());
+	vector<scalar> values(program.results.size()); // derivative k+1 of component i, at k*components+i
+	vector<scalar> p(program.components);
+	scalar step=(a_or_b==1)?h:-h;
+	write_system_row(file, t, x);
+	for (long i=1; i<=n; i++){ // For each step...
+		evaluate_system(program, &registers[0], &x[0], t, &values[0]);
+		sum_taylor_system(&values[0], program.components, program.number_of_terms, step, &p[0], &x[0]);
+		t+=step;
+		write_system_row(file, t, x);
+	}
 }
 
 
-// FUNCTION - Break Into Plus Minus
+// FUNCTION - Split List
+
+// Splits 'str' at each 'separator' and returns the pieces.
+vector<string> split_list(const string & str, char separator){
+	vector<string> pieces;
+	size_t start=0;
+	for (size_t end=str.find(separator); end!=string::npos; end=str.find(separator, start)){
+		pieces.push_back(str.substr(start, end-start));
+		start=end+1;
+	}
+	pieces.push_back(str.substr(start));
+	return pieces;
+}
 
-// If function is a sum or difference, break into summed/subtracted terms, returning a structure of type terms_sum_difference.
 
-terms_sum_difference break_into_plus_minus(string str){ // (a+b)*c+d*h*l-e/(f-g)
-	terms_sum_difference plus_minus_terms; // Create 'terms' object which will hold the added or subtracted terms in the string.
-	int brackets=0; // If 'brackets' is 0, all brackets are closed.
-	for (int i=0; i<str.length(); i++){ // For each element of string
-		if (str[i]=='(')
-			brackets++; // Increment 'brackets' to tell us there will be a ) bracket later in the string.
-		if (str[i]==')')
-			brackets--; // Decrement 'brackets'. If this sets 'brackets' to zero, string so far is a +- term.
-		if (((brackets==0)&&(str[i]=='+'))||((brackets==0)&&(str[i]=='-')&&(i>0))){ // If there is a + not enclosed within brackets...
-			if (plus_minus_terms.indices.empty()) // If this is the first such term...
-				plus_minus_terms.terms.push_back(str.substr(0,i));
-			else // If this is not the first such term...
-				plus_minus_terms.terms.push_back(str.substr((plus_minus_terms.indices.back()+1),(i-plus_minus_terms.indices.back()-1)));
-			plus_minus_terms.indices.push_back(i);
-			plus_minus_terms.symbols.push_back(str[i]);
-		}
-		if (i==(str.length()-1)){ // If we've reached the end of the string...
-			if (plus_minus_terms.indices.empty()) // If there were no + or -...
-				plus_minus_terms.terms.push_back(str.substr(0,str.length())); // 012345
-			else // If there has been at least one + or - symbol...
-				plus_minus_terms.terms.push_back(str.substr((plus_minus_terms.indices.back()+1),str.length()-plus_minus_terms.indices.back()-1));
+// FUNCTION - System Command
+
+// Solves a system from the command line: Derivative_Calculator --system "f1;f2;..." --initial x1,x2,... [--interval a b]
+// [--h H] [--terms N] [--backward]. fi is xi' in terms of x1 through xN and t, and the initial values are given at a
+// (or at b, with --backward). Rows of t, x1, ..., xN are written to solve_system.dat.
+int system_command(int argc, char * argv[]){
+	if (argc<3){
+		cout<<"error: no system given"<<endl;
+		return 1;
+	}
+	vector<string> functions=split_list(argv[2], ';');
+	vector<string> initial;
+	double a=0, b=1, h=0.01;
+	int number_of_terms=8, forward_backward=1;
+	for (int i=3; i<argc; i++){ // For each argument after the system...
+		if ((strcmp(argv[i], "--initial")==0)&&(i+1<argc))
+			initial=split_list(argv[++i], ',');
+		else if ((strcmp(argv[i], "--interval")==0)&&(i+2<argc)){
+			a=atof(argv[++i]);
+			b=atof(argv[++i]);
 		}
+		else if ((strcmp(argv[i], "--h")==0)&&(i+1<argc))
+			h=atof(argv[++i]);
+		else if ((strcmp(argv[i], "--terms")==0)&&(i+1<argc))
+			number_of_terms=atoi(argv[++i]);
+		else if (strcmp(argv[i], "--backward")==0)
+			forward_backward=2;
+	}
+	if (initial.size()!=functions.size()){
+		cout<<"error: "<<functions.size()<<" equations but "<<initial.size()<<" initial values"<<endl;
+		return 1;
+	}
+	int start_s=clock();
+	expression_pool pool;
+	derivative_cache cache;
+	vector<const expression_node *> derivatives;
+	compiled_system program;
+	if (!system_derivatives(functions, number_of_terms, pool, cache, derivatives)||!compile_system(derivatives, functions.size(), number_of_terms, pool, program))
+		return 1;
+	long separate=0; // Instructions needed if every derivative were compiled on its own.
+	for (int e=0; e<derivatives.size(); e++){
+		unordered_set<const expression_node *> visited;
+		separate+=count_nodes(derivatives[e], visited);
 	}
-	//print_terms(plus_minus_terms);
-	return plus_minus_terms;
+	cout<<functions.size()<<" equations, "<<number_of_terms<<" terms: "<<program.tape.code.size()<<" instructions ("<<separate<<" if compiled separately)"<<endl;
+	vector<double> x(initial.size());
+	for (int i=0; i<initial.size(); i++)
+		x[i]=atof(initial[i].c_str());
+	FILE * file=fopen("solve_system.dat", "w");
+	if (file==nullptr){
+		cout<<"error: could not open solve_system.dat"<<endl;
+		return 1;
+	}
+	taylor_system(program, (forward_backward==1)?a:b, x, h, (long)((b-a)/h), forward_backward, file);
+	fclose(file);
+	int stop_s=clock();
+	cout<<"x("<<((forward_backward==1)?b:a)<<") =";
+	for (int i=0; i<x.size(); i++)
+		cout<<" "<<x[i];
+	cout<<endl<<"runtime: "<<(stop_s-start_s)/double(CLOCKS_PER_SEC)*1000<<" ms"<<endl;
+	return 0;
 }
 
+// END SYSTEM FUNCTIONS
 
-// FUNCTION - Break Into Mult Divide
 
-// If function is a product or quotient, break into multiplied/divided terms, returning a structure of type terms_mult/divide.
 
-terms_product_quotient break_into_mult_divide(string str){
-	terms_product_quotient mult_divide_terms; // Create 'terms' object which will hold the added or subtracted terms in the string.
-	int brackets=0; // If 'brackets' is 0, all brackets are closed.
-	for (int i=0; i<str.length(); i++){ // For each element of string
-		if (str[i]=='(')
-			brackets++; // Increment 'brackets' to tell us there will be a ) bracket later in the string.
-		if (str[i]==')')
-			brackets--; // Decrement 'brackets'. If this sets 'brackets' to zero, string so far is a +- term.
-		if ((brackets==0)&&((str[i]=='*')||(str[i]=='/'))){ // If there is a + not enclosed within brackets...
-			mult_divide_terms.terms.push_back(str.substr(0,i));
-			mult_divide_terms.terms.push_back(str.substr(i+1,str.length()-i-1));
-			mult_divide_terms.index=i;
-			mult_divide_terms.symbol=str[i];
-			//print_terms(mult_divide_terms);
-			return mult_divide_terms;
-		}
+// START ENSEMBLE FUNCTIONS
+
+
+// FUNCTION - Propagate
+
+// Takes n steps of width 'step' from (x,t) with the Taylor method, without output, leaving the end point in x and t.
+template<class scalar> void propagate(scalar x1(scalar, scalar, const compiled_derivatives &, int, basic_evaluation_scratch<scalar> &), const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, basic_evaluation_scratch<scalar> & scratch, basic_jet_scratch<scalar> & jets, scalar * values, scalar & x, scalar & t, scalar step, long n){
+	for (long i=0; i<n; i++){ // For each step...
+		x+=taylor_increment(x1, program, number_of_terms, engine, scratch, jets, values, x, t, step);
+		t+=step;
 	}
-	mult_divide_terms.terms.push_back(str.substr(0,str.length()));
-	mult_divide_terms.index=0;
-	mult_divide_terms.symbol='\0';
-	//print_terms(mult_divide_terms);
-	return mult_divide_terms;
 }
 
-// END ORGANIZATION FUNCTIONS
 
+// FUNCTION - Instance Steps
 
+// Returns the number of steps of width h that cover [a,b] for 'instance', rounded down as in solve_problem, or -1 if h is
+// not positive, b is less than a, or the number of steps cannot be held in a long.
+long instance_steps(const problem_instance & instance){
+	double steps=(instance.b-instance.a)/instance.h;
+	if (!(instance.h>0)||!(steps>=0)||!(steps<9.2e18)) // 9.2e18 is just below the largest long, 2^63-1.
+		return -1;
+	return long(steps);
+}
 
-// START DERIVATIVE FUNCTIONS
 
-// FUNCTION - Differentiate
-// Return derivative of string.
-string differentiate(string str, vector<string> & vector, int num_taylor_terms){
+// FUNCTION - Integrate Instance
+
+// Runs the Taylor method for one problem instance, without output, and returns the end point. 'scratch', 'jets' and
+// 'values' belong to the calling worker, so any number of workers can share 'program'. An instance without a valid
+// number of steps is not run; its result has steps set to -1 and t, x and error set to NaN.
+template<class scalar> ensemble_result integrate_instance(const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, const problem_instance & instance, basic_evaluation_scratch<scalar> & scratch, basic_jet_scratch<scalar> & jets, scalar * values){
+	ensemble_result result;
+	scalar step=(instance.forward_backward==1)?instance.h:-instance.h;
+	scalar t=(instance.forward_backward==1)?instance.a:instance.b;
+	scalar x=instance.xa;
+	long n=instance_steps(instance);
+	if (n<0){
+		result.t=result.x=result.error=NAN;
+		result.steps=-1;
+		return result;
+	}
+	propagate((program.native!=nullptr)?dx_native<scalar>:dx<scalar>, program, number_of_terms, engine, scratch, jets, values, x, t, step, n);
+	result.t=double(t);
+	result.x=double(x);
+	result.error=double(fabs(((program.expressions.size()>number_of_terms)?evaluate(program, number_of_terms, scratch, x, t):scalar(0))-x));
+	result.steps=n;
+	return result;
+}
 
-	// STEP 1 - If original function is entirely enclosed by brackets, remove these brackets.
-	if (outer_brackets(str)) // If there are brackets enclosing a +- term, such as in (a+b)*c
-		return '('+differentiate(str.substr(1,str.length()-2), vector, num_taylor_terms)+')'; // Differentiate contents of brackets and return, enclosed in brackets
 
-	// STEP 2 - Test if function is a sum or difference, and if so differentiate and add/subtract these derivatives.
-	terms_sum_difference plus_minus=break_into_plus_minus(str); // Break into summed/subtracted terms.
+// FUNCTION - Next Instance
 
-	if (plus_minus.indices.empty()==false){ // If string is a sum or difference...
-		string d_plus_minus=differentiate(plus_minus.terms[0], vector, num_taylor_terms); // Differentiate first term.
-		for (int i=0; i<plus_minus.indices.size(); i++){ // For each subsequent term...
-			d_plus_minus=d_plus_minus+plus_minus.symbols[i]+differentiate(plus_minus.terms[i+1], vector, num_taylor_terms); // Differentiate and add to output string of derivatives.
+// Returns the index of the next instance for worker 'self' to run, or -1 if there are none left anywhere. The worker
+// takes from the front of its own range; once that is empty it steals the back half of the first other range that still
+// has work. Only one lock is held at a time. Instances are never added, so when every range is empty, all work has
+// been handed out.
+int next_instance(vector<work_range> & ranges, int self){
+	work_range & own=ranges[self];
+	{
+		lock_guard<mutex> guard(own.lock);
+		if (own.begin<own.end)
+			return own.begin++;
+	}
+	for (int i=1; i<ranges.size(); i++){ // For each other worker...
+		work_range & victim=ranges[(self+i)%ranges.size()];
+		int begin, end;
+		{
+			lock_guard<mutex> guard(victim.lock);
+			if (victim.begin>=victim.end) // If it has nothing left...
+				continue;
+			end=victim.end;
+			begin=victim.end-(victim.end-victim.begin+1)/2; // Take the back half, rounding up.
+			victim.end=begin;
 		}
-		return d_plus_minus; // Return completely differentiated string.
+		lock_guard<mutex> guard(own.lock);
+		own.begin=begin+1;
+		own.end=end;
+		return begin;
 	}
+	return -1;
+}
+
 
-	// If we have reached this point, str was not a sum/difference, so we treat it as a product/quotient.
+// FUNCTION - Ensemble Worker
+
+// Runs instances until no work is left in any range, writing each result to its own slot of 'results'.
+void ensemble_worker(const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, const vector<problem_instance> & instances, vector<ensemble_result> & results, vector<work_range> & ranges, int self){
+	evaluation_scratch scratch; // Registers used when evaluating compiled expressions.
+	prepare_scratch(program, scratch);
+	jet_scratch jets; // Series used by the jet engine.
+	if (engine==JET_ENGINE)
+		prepare_jet_scratch(program, number_of_terms, jets);
+	vector<double> values(number_of_terms+1); // Derivatives or Taylor coefficients at each step.
+	int index;
+	while ((index=next_instance(ranges, self))>=0)
+		results[index]=integrate_instance(program, number_of_terms, engine, instances[index], scratch, jets, &values[0]);
+}
 
-	// STEP 3 - Test if function is a product or quotient, and if so use product/quotient rule to differentiate.
-	terms_product_quotient mult_divide=break_into_mult_divide(str); // 012345
 
-	if (mult_divide.index!=0){ // If string is a product or quotient...
-		if (mult_divide.symbol=='*') // If it is a product...
-			return product_rule(str.substr(0,mult_divide.index), str.substr(mult_divide.index+1, str.length()-mult_divide.index-1), vector, num_taylor_terms); // Differentiate using product rule.
-		else // If it is a quotient...
-			return quotient_rule(str.substr(0,mult_divide.index), str.substr(mult_divide.index+1, str.length()-mult_divide.index-1), vector, num_taylor_terms); // Differentiate using quotient rule.
+// FUNCTION - Solve Ensemble
+
+// Integrates every instance in 'instances' with the compiled derivatives in 'program', using 'threads' worker threads
+// (or one per core, if 'threads' is 0). Each worker starts with an equal share of the instances and steals from the
+// others when it runs out, so instances of different lengths still keep all workers busy. results[i] is the end point
+// of instances[i].
+void solve_ensemble(const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, const vector<problem_instance> & instances, vector<ensemble_result> & results, int threads){
+	if (threads<=0)
+		threads=thread::hardware_concurrency();
+	threads=max(1, min(threads, (int)instances.size()));
+	results.assign(instances.size(), ensemble_result());
+	vector<work_range> ranges(threads);
+	for (int w=0; w<threads; w++){ // Give each worker an equal share to start with.
+		ranges[w].begin=(long)instances.size()*w/threads;
+		ranges[w].end=(long)instances.size()*(w+1)/threads;
 	}
+	vector<thread> workers;
+	for (int w=1; w<threads; w++)
+		workers.push_back(thread(ensemble_worker, cref(program), number_of_terms, engine, cref(instances), ref(results), ref(ranges), w));
+	ensemble_worker(program, number_of_terms, engine, instances, results, ranges, 0); // The calling thread is worker 0.
+	for (int w=0; w<workers.size(); w++)
+		workers[w].join();
+}
 
-	// If we have reached this point, str was neither a sum/difference nor a product/quotient, so we treat it as an individual elementary function.
+// END ENSEMBLE FUNCTIONS
 
-	// STEP 4 - Differentiate individual elementary function.
 
-	if (str[0]=='-') // If function is negative...
-		return "-"+differentiate(str.substr(1,str.length()-1), vector, num_taylor_terms);
 
-	// CASE 1: str is a constant
-	if (::atof(str.c_str())!=0.0){
-		return "0"; // Its derivative is zero (we will remove any terms by which it is multiplied later)
-	}
+// START PARAREAL FUNCTIONS
 
-	// CASE 2: str has an exponent
-	// CASE 2a: it is exp(____)
-	if (str.substr(0,3)=="exp"){
-		string y=str.substr(3,str.length()-3); // Take argument (as in exp(argument))
-		return differentiate(y, vector, num_taylor_terms)+"*exp"+y; // Derivative is argument' * exp(argument)
-	}
-	// CASE 2b: it is any other kind of exponential
+// In this section one trajectory is split into time slices that are run at the same time. Slice j starts at times[j]
+// from boundary[j], the current guess of x there. Each iteration runs the fine propagator on every slice not yet exact,
+// in parallel, and then sweeps through the slices in order, replacing each guess by coarse(new guess) + fine(old guess)
+// - coarse(old guess). After k iterations the first k slices are exact, so the method always ends after at most one
+// iteration per slice; it is faster than running the slices one after another when far fewer iterations are needed.
 
-	if (str.substr(0,3)=="pow"){ // pow(we,erty)  pow(t,2)
-		int index_of_comma; // Index of string at which comma appears.
-		for (int i=4; i<(str.length()-2); i++){ // For each element of argument to 'pow'...
-			if (str[i]==',') // If character is a comma...
-				index_of_comma=i; // Save this index.
-		}
-		string argument=str.substr(4,(index_of_comma-4)); // argument of exponent.
-		string exponent=str.substr(index_of_comma+1,(str.length()-index_of_comma-2)); // exponent
-		if (::atof(exponent.c_str())!=0.0){ // If exponent is a number...
-			if (stod(exponent)==2) // ...and if it is 2...
-				return "2*"+differentiate(argument, vector, num_taylor_terms)+"*"+argument;
-			return exponent+"*"+differentiate(argument, vector, num_taylor_terms)+"*pow("+argument+","+to_string(stod(exponent)-1)+")";
-			//return x+'^'+'('+y+"-1)*("+y+'*'+differentiate(x)+'+'+x+"*log("+x+"))*"+differentiate(y);
-		}
-	}
 
-	// CASE 3: function is x or a derivative of x.
-	for (int i=0; i<(num_taylor_terms); i++){
-		if (str==vector[i]) // If function is i-th derivative of x...
-			return vector[i+1]; // Return next higher derivative.
+// FUNCTION - Parareal Slices
+
+// Runs the fine propagator on slices handed out through 'ranges' (as in ensemble_worker), until none are left, writing
+// the end of slice j to fine[j]. 'scratch', 'jets' and 'values' belong to worker 'self'.
+void parareal_slices(const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, const vector<double> & boundary, const vector<double> & times, const vector<long> & first, double step, vector<double> & fine, vector<work_range> & ranges, int self, evaluation_scratch & scratch, jet_scratch & jets, double * values){
+	int j;
+	while ((j=next_instance(ranges, self))>=0){ // For each slice...
+		double x=boundary[j], t=times[j];
+		propagate((program.native!=nullptr)?dx_native<double>:dx<double>, program, number_of_terms, engine, scratch, jets, values, x, t, step, first[j+1]-first[j]);
+		fine[j]=x;
 	}
+}
 
-	// CASE 4: function is t
-	if (str=="t")
-		return "1";
 
-	// CASE 5: function is trigonometric.
-	if (str.substr(0,3)=="sin"){
-		string temp=str;
-		temp.replace(0,3,"cos");
-		return differentiate(temp.substr(3,temp.length()-3), vector, num_taylor_terms)+"*"+temp;
+// FUNCTION - Parareal Worker
+
+// Runs the fine propagator for worker 'self' in every iteration of a parareal run, waiting on 'team' for each one to
+// begin, until the run is over. The scratch space is prepared once, not once per iteration.
+void parareal_worker(const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, const vector<double> & boundary, const vector<double> & times, const vector<long> & first, double step, vector<double> & fine, parareal_team & team, int self){
+	evaluation_scratch scratch; // Registers used when evaluating compiled expressions.
+	prepare_scratch(program, scratch);
+	jet_scratch jets; // Series used by the jet engine.
+	if (engine==JET_ENGINE)
+		prepare_jet_scratch(program, number_of_terms, jets);
+	vector<double> values(number_of_terms+1); // Derivatives or Taylor coefficients at each step.
+	int round=0;
+	while (true){ // For each iteration...
+		{
+			unique_lock<mutex> guard(team.lock);
+			team.start.wait(guard, [&](){ return (team.round>round)||team.stopping; });
+			if (team.stopping)
+				return;
+			round=team.round;
+		}
+		parareal_slices(program, number_of_terms, engine, boundary, times, first, step, fine, team.ranges, self, scratch, jets, &values[0]);
+		lock_guard<mutex> guard(team.lock);
+		if (--team.running==0)
+			team.finished.notify_one();
 	}
+}
 
-	if (str.substr(0,3)=="cos"){
-		string temp=str;
-		temp.replace(0,3,"sin");
-		return "(-"+differentiate(temp.substr(3,temp.length()-3), vector, num_taylor_terms)+"*"+temp+")";
+
+// FUNCTION - Parareal
+
+// Integrates n steps of width 'step' from (x,t), as taylor() would, using parareal with the settings in 'control'. The
+// fine propagator is the Taylor method with number_of_terms terms; the coarse one uses the first control.coarse_terms
+// terms of the same program (at most number_of_terms) with larger steps. On return, 'times' and 'boundary' hold t and x
+// at the start of each slice and at the end of the run.
+void parareal(const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, double x, double t, double step, long n, parareal_control & control, vector<double> & times, vector<double> & boundary){
+	int threads=(control.threads<=0)?thread::hardware_concurrency():control.threads;
+	int slices=(control.slices<=0)?threads:control.slices;
+	slices=max(1, (int)min<long>(slices, n));
+	threads=max(1, min(threads, slices));
+	int coarse_terms=max(1, min(control.coarse_terms, number_of_terms));
+	vector<long> first(slices+1); // first step of each slice
+	vector<long> coarse_steps(slices); // number of coarse steps in each slice
+	times.resize(slices+1);
+	for (int j=0; j<=slices; j++){
+		first[j]=n*j/slices;
+		times[j]=t+step*first[j];
+	}
+	for (int j=0; j<slices; j++)
+		coarse_steps[j]=max(1L, (first[j+1]-first[j]+control.coarse_factor-1)/max(1, control.coarse_factor));
+
+	// The coarse propagator runs on the calling thread.
+	evaluation_scratch scratch;
+	prepare_scratch(program, scratch);
+	jet_scratch jets;
+	if (engine==JET_ENGINE)
+		prepare_jet_scratch(program, coarse_terms, jets);
+	vector<double> values(coarse_terms+1);
+	double (*x1)(double, double, const compiled_derivatives &, int, evaluation_scratch &)=(program.native!=nullptr)?dx_native<double>:dx<double>;
+	vector<double> coarse(slices), fine(slices); // end of each slice from the coarse and fine propagators
+	boundary.assign(slices+1, x);
+	for (int j=0; j<slices; j++){ // First guess: the coarse propagator alone.
+		double xj=boundary[j], tj=times[j];
+		propagate(x1, program, coarse_terms, engine, scratch, jets, &values[0], xj, tj, step*(first[j+1]-first[j])/coarse_steps[j], coarse_steps[j]);
+		coarse[j]=boundary[j+1]=xj;
 	}
 
-	if (str.substr(0,3)=="tan"){
-		string temp=str;
-		temp.replace(0,3,"cos");
-		return differentiate(temp.substr(3,temp.length()-3), vector, num_taylor_terms)+"*(1/tan("+temp.substr(3,temp.length()-3)+"))^2";
+	// The calling thread is fine worker 0; the others are started once, and wait on 'team' between iterations.
+	evaluation_scratch fine_scratch;
+	prepare_scratch(program, fine_scratch);
+	jet_scratch fine_jets;
+	if (engine==JET_ENGINE)
+		prepare_jet_scratch(program, number_of_terms, fine_jets);
+	vector<double> fine_values(number_of_terms+1);
+	parareal_team team(threads);
+	vector<thread> workers;
+	for (int w=1; w<threads; w++)
+		workers.push_back(thread(parareal_worker, cref(program), number_of_terms, engine, cref(boundary), cref(times), cref(first), step, ref(fine), ref(team), w));
+
+	control.iterations=0;
+	control.change=0;
+	for (int k=0; k<slices; k++){ // For each iteration, while slices k and later may still change...
+		for (int w=0; w<threads; w++){ // Give each worker an equal share of the slices to start with.
+			team.ranges[w].begin=k+(slices-k)*w/threads;
+			team.ranges[w].end=k+(slices-k)*(w+1)/threads;
+		}
+		{
+			lock_guard<mutex> guard(team.lock);
+			team.round++;
+			team.running=threads-1;
+		}
+		team.start.notify_all();
+		parareal_slices(program, number_of_terms, engine, boundary, times, first, step, fine, team.ranges, 0, fine_scratch, fine_jets, &fine_values[0]);
+		{
+			unique_lock<mutex> guard(team.lock);
+			team.finished.wait(guard, [&](){ return team.running==0; });
+		}
+		control.iterations++;
+		control.change=0;
+		for (int j=k; j<slices; j++){ // Correct the guesses in order, each from the one before.
+			double xj=boundary[j], tj=times[j];
+			propagate(x1, program, coarse_terms, engine, scratch, jets, &values[0], xj, tj, step*(first[j+1]-first[j])/coarse_steps[j], coarse_steps[j]);
+			double corrected=fine[j]+(xj-coarse[j]); // Exactly fine[j] if the start of the slice did not change
+			coarse[j]=xj;
+			control.change=max(control.change, fabs(corrected-boundary[j+1]));
+			boundary[j+1]=corrected;
+		}
+		if (control.change<=control.tolerance)
+			break;
 	}
+	{
+		lock_guard<mutex> guard(team.lock);
+		team.stopping=true;
+	}
+	team.start.notify_all();
+	for (int w=0; w<workers.size(); w++)
+		workers[w].join();
+}
+
+
+// FUNCTION - Parareal Command
 
-	// If there are +- terms within the */ term, re-iterate derivative process on them, such as (a+b)*c
-	for (int i=0; i<str.length(); i++){
-		if ((str[i]=='+')||(str[i]=='-')){
-			differentiate(str, vector, num_taylor_terms);
+// Solves x' = f with parareal from the command line: Derivative_Calculator --parareal "f" --initial xa [--exact "e"]
+// [--interval a b] [--h H] [--terms N] [--coarse-terms M] [--coarse-factor K] [--slices S] [--threads T]
+// [--tolerance tol] [--engine symbolic|jet|native] [--backward]. The initial value is given at a (or at b, with
+// --backward). Rows of t and x at the start of each slice, and at the end, are written to solve_parareal.dat.
+int parareal_command(int argc, char * argv[]){
+	if (argc<3){
+		cout<<"error: no function given"<<endl;
+		return 1;
+	}
+	string function=argv[2], exact;
+	double a=0, b=1, h=0.01, xa=0;
+	int number_of_terms=8, forward_backward=1;
+	coefficient_engine engine=JET_ENGINE;
+	parareal_control control;
+	bool initial=false;
+	for (int i=3; i<argc; i++){ // For each argument after the function...
+		if ((strcmp(argv[i], "--initial")==0)&&(i+1<argc)){
+			xa=atof(argv[++i]);
+			initial=true;
+		}
+		else if ((strcmp(argv[i], "--exact")==0)&&(i+1<argc))
+			exact=argv[++i];
+		else if ((strcmp(argv[i], "--interval")==0)&&(i+2<argc)){
+			a=atof(argv[++i]);
+			b=atof(argv[++i]);
 		}
+		else if ((strcmp(argv[i], "--h")==0)&&(i+1<argc))
+			h=atof(argv[++i]);
+		else if ((strcmp(argv[i], "--terms")==0)&&(i+1<argc))
+			number_of_terms=atoi(argv[++i]);
+		else if ((strcmp(argv[i], "--coarse-terms")==0)&&(i+1<argc))
+			control.coarse_terms=atoi(argv[++i]);
+		else if ((strcmp(argv[i], "--coarse-factor")==0)&&(i+1<argc))
+			control.coarse_factor=atoi(argv[++i]);
+		else if ((strcmp(argv[i], "--slices")==0)&&(i+1<argc))
+			control.slices=atoi(argv[++i]);
+		else if ((strcmp(argv[i], "--threads")==0)&&(i+1<argc))
+			control.threads=atoi(argv[++i]);
+		else if ((strcmp(argv[i], "--tolerance")==0)&&(i+1<argc))
+			control.tolerance=atof(argv[++i]);
+		else if ((strcmp(argv[i], "--engine")==0)&&(i+1<argc)){
+			i++;
+			engine=(strcmp(argv[i], "symbolic")==0)?SYMBOLIC_ENGINE:((strcmp(argv[i], "native")==0)?NATIVE_ENGINE:JET_ENGINE);
+		}
+		else if (strcmp(argv[i], "--backward")==0)
+			forward_backward=2;
+	}
+	if (!initial){
+		cout<<"error: no initial value given"<<endl;
+		return 1;
 	}
+	chrono::steady_clock::time_point start=chrono::steady_clock::now(); // Wall time, since the fine solves run on several cores
+	derivative_sequence sequence;
+	compiled_derivatives program;
+	if (!compile_function(sequence, function, exact, number_of_terms, engine, program)) // From the program cache, if an earlier run compiled it
+		return 1;
+	bool cached;
+	if ((engine==NATIVE_ENGINE)&&!jit_compile(program, cached)) // If machine code cannot be built, run the compiled expressions instead.
+		cout<<"warning: could not compile derivatives to machine code; evaluating them instead"<<endl;
+	vector<double> times, boundary;
+	parareal(program, number_of_terms, engine, xa, (forward_backward==1)?a:b, (forward_backward==1)?h:-h, (long)((b-a)/h), control, times, boundary);
+	FILE * file=fopen("solve_parareal.dat", "w");
+	if (file==nullptr){
+		cout<<"error: could not open solve_parareal.dat"<<endl;
+		return 1;
+	}
+	for (int j=0; j<times.size(); j++)
+		fprintf(file, "%.17g %.17g\n", times[j], boundary[j]);
+	fclose(file);
+	cout<<times.size()-1<<" slices, "<<control.iterations<<" iterations, last change "<<control.change<<endl;
+	cout<<setprecision(16)<<"x("<<times.back()<<") = "<<boundary.back();
+	if (!exact.empty()){
+		evaluation_scratch scratch;
+		prepare_scratch(program, scratch);
+		cout<<", error "<<setprecision(6)<<fabs(evaluate(program, number_of_terms, scratch, 0.0, times.back())-boundary.back());
+	}
+	cout<<endl<<"runtime: "<<elapsed_ns(start)/1e6<<" ms"<<endl;
+	return 0;
+}
 
-	return "error";
+// END PARAREAL FUNCTIONS
+
+
+
+// START LIBRARY FUNCTIONS
+
+
+// Number of input lines read at a time in batch mode. Lines are differentiated in parallel, one block at a time, and each
+// block is written out in order before the next is read.
+const int batch_block_lines=4096;
+
+
+// FUNCTION - Create Derivative Session
+
+derivative_session * create_derivative_session(){
+	return new derivative_session();
 }
 
 
-// FUNCTION - Product Rule
+// FUNCTION - Destroy Derivative Session
 
-string product_rule(string term_one, string term_two, vector<string> & vector, int num_taylor_terms){
-	string d1=differentiate(term_one, vector, num_taylor_terms);
-	string d2=differentiate(term_two, vector, num_taylor_terms);
-	if (((d1=="0")&&(d2=="0"))||((d1=="(0)")&&(d2=="0"))||((d1=="0")&&(d2=="(0)"))||((d1=="(0)")&&(d2=="(0)")))
-		return "0";
-	if ((d1=="0")||(d1=="(0)"))
-		return term_one+'*'+d2;
-	if ((d2=="0")||(d2=="(0)"))
-		return d1+'*'+term_two;
-	return '('+d1+'*'+term_two+'+'+term_one+'*'+d2+')';
+void destroy_derivative_session(derivative_session * session){
+	delete session;
 }
 
 
-// FUNCTION - Quotient rule
+// FUNCTION - Session Derivatives
 
-string quotient_rule(string term_one, string term_two, vector<string> & vector, int num_taylor_terms){
-	string d1=differentiate(term_one, vector, num_taylor_terms);
-	string d2=differentiate(term_two, vector, num_taylor_terms);
-	if (((d1=="0")&&(d2=="0"))||((d1=="(0)")&&(d2=="0"))||((d1=="0")&&(d2=="(0)"))||((d1=="(0)")&&(d2=="(0)")))
-		return "0";
-	if ((d1=="0")||(d1=="(0)"))
-		return '-'+term_one+'*'+d2+'/'+term_two+"^2";
-	if ((d2=="0")||(d2=="(0)"))
-		return d1+'*'+term_two+"/"+term_two+"^2";
-	return '('+d1+'*'+term_two+'-'+term_one+'*'+d2+")/("+term_two+"^2)";
+// Differentiates 'function' using the pool and caches of 'session', in the same way as main(). If 'function' cannot be
+// parsed, says why in session->error.
+bool session_derivatives(derivative_session * session, const string & function, int number_of_terms, vector<string> & derivatives){
+	derivatives.clear();
+	if (session->pool.index.size()>session_node_limit){ // If the pool has grown too large, start again.
+		reset_cache(session->cache);
+		reset_pool(session->pool);
+	}
+	const expression_node * expression=parse_expression(function, session->pool, session->error);
+	if (expression==nullptr)
+		return false;
+	expression=simplify(expression, session->pool, session->cache.simplified);
+	derivatives.push_back(function);
+	for (int i=1; i<number_of_terms; i++){ // For each derivative...
+		expression=traced_derivative(expression, session->pool, session->cache, i+1);
+		derivatives.push_back(expression_to_string(expression));
+	}
+	return true;
 }
 
 
-// FUNCTION - Output Derivative
+// FUNCTION - Session Error
 
-// Performs Derivative and Clean Up operations on an input string.
+string session_error(const derivative_session * session){
+	return session->error.message;
+}
 
-string output_derivative(string str, vector<string> & vector, int num_terms){
-	string derivative=differentiate(str, vector, num_terms);
-	clean_up(derivative);
-	return derivative;
+
+// FUNCTION - Session Solve
+
+// Solves x' = 'function' with the Taylor method to 'number_of_terms' terms, in steps of h from x=xa at a to b (or from b
+// to a, if 'backward'), keeping the Taylor polynomial of every step in 'dense'. The jet engine is used, so 'function' is
+// parsed and compiled once, as x' alone, and no higher derivative is made. Returns false, and says why in
+// session->error, if 'function' cannot be parsed, if number_of_terms is less than 1, h is not positive or b is less
+// than a, or if the solution blows up before the end; 'dense' then covers the steps taken, if any.
+bool session_solve(derivative_session * session, const string & function, int number_of_terms, double a, double b, double h, double xa, bool backward, dense_solution & dense){
+	problem_instance instance={xa, a, b, h, backward?2:1};
+	long n=instance_steps(instance);
+	start_dense(dense);
+	session->error=parse_error();
+	if ((n<0)||(number_of_terms<1)){
+		session->error.message=(number_of_terms<1)?"terms must be at least 1":"h must be positive and b no less than a";
+		return false;
+	}
+	derivative_sequence sequence;
+	compiled_derivatives program;
+	if (!start_sequence(sequence, function, session->error)||!compile_sequence(sequence, "", number_of_terms, JET_ENGINE, program))
+		return false;
+	evaluation_scratch scratch; // Registers used when evaluating compiled expressions.
+	prepare_scratch(program, scratch);
+	jet_scratch jets; // Series used by the jet engine.
+	prepare_jet_scratch(program, number_of_terms, jets);
+	vector<double> values(number_of_terms+1); // Taylor coefficients at each step
+	double step=backward?-h:h;
+	double t=backward?b:a, x=xa;
+	for (long i=0; i<n; i++){ // For each step...
+		double increment=taylor_increment(dx<double>, program, number_of_terms, JET_ENGINE, scratch, jets, &values[0], x, t, step);
+		if (!isfinite(x+increment)){ // If the solution has blown up, keep only the steps before it.
+			session->error.message="the solution could not be continued past t="+to_string(t);
+			finish_dense(dense, t, backward);
+			return false;
+		}
+		dense_step(dense, &values[0], number_of_terms, JET_ENGINE, x, t);
+		x+=increment;
+		t+=step;
+	}
+	finish_dense(dense, t, backward);
+	return true;
 }
 
-// END DERIVATIVE FUNCTIONS
+
+// FUNCTION - JSON Escape
+
+// Returns 'str' as a JSON string literal, including the quotes.
+string json_escape(const string & str){
+	string out="\"";
+	for (int i=0; i<str.length(); i++){ // For each character...
+		char c=str[i];
+		if ((c=='"')||(c=='\\'))
+			out+='\\';
+		if ((unsigned char)c<0x20){ // Control characters are written as \u00XX.
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			out+=code;
+		} else
+			out+=c;
+	}
+	return out+'"';
+}
 
 
+// FUNCTION - JSON Value Position
+
+// Returns the position of the value after "key": in a single-line JSON object, or string::npos if the key is not
+// present. A quoted key that is not followed by a colon is a string value, such as the function "x", and is skipped.
+size_t json_value_position(const string & line, const string & key){
+	size_t i=0;
+	do { // Until the key is found followed by a colon...
+		i=line.find('"'+key+'"', i);
+		if (i==string::npos)
+			return string::npos;
+		i=line.find_first_not_of(" \t", i+key.length()+2);
+		if (i==string::npos)
+			return string::npos;
+	} while (line[i]!=':');
+	return line.find_first_not_of(" \t", i+1);
+}
 
-// START CLEANUP FUNCTIONS
-
-
-// FUNCTION - Clear Duplicate Symbols
-
-// Scans through output (differentiated) string and removes any obsolete +-*/ symbols. For example,
-// if we differentiate x+4-t we get x'-1, but this will initially appear as x'+-1 because d(4)/dt=0,
-// and this character will be removed. Thus, we remove the + character.
-void clear_duplicate_symbols(string & str){
-	for (int i=str.length()-1; i>=0; i--){ // For each character in string (starting from the end so that removing a character does not affect the indices of characters subsequently under consideration)...
-		if (((str[i]=='+')||(str[i]=='-')||(str[i]=='*')||(str[i]=='/'))&&((str[i-1]=='+')||(str[i-1]=='-')||(str[i-1]=='*')||(str[i-1]=='/'))) // If there are two consecutive +-*/ characters...
-			str.erase(i-1,1); // Erase the first, because it is either adding/subtracting 0, or multiplying or dividing by 1.
-	}
-}
-
-
-// FUNCTION - Clear Head Or Tail Symbols
 
-// If there is a +-*/ character at the beginning or end of an output (differentiated) string, except
-// in the case of a - character at the beginning, remove it.
-void clear_head_or_tail_symbols(string & str){
-	if ((str[0]=='+')||(str[0]=='*')||(str[0]=='/')) // If first character is +, -, or *...
-		str.erase(0,1); // Remove it.
-	if ((str[str.length()-1]=='+')||(str[str.length()-1]=='*')||(str[str.length()-1]=='/')) // If last character is +, -, *, or /...
-		str.erase(str.length()-1,1); // Remove it.
+// FUNCTION - JSON Field
+
+// Finds "key": value in a single-line JSON object and sets 'value' to the string (unescaped) or number after the colon.
+// Only the simple objects used as batch input are handled. Returns false if the key is not present.
+bool json_field(const string & line, const string & key, string & value){
+	size_t i=json_value_position(line, key);
+	if (i==string::npos)
+		return false;
+	value.clear();
+	if (line[i]=='"'){ // If the value is a string...
+		for (i++; (i<line.length())&&(line[i]!='"'); i++){
+			if ((line[i]=='\\')&&(i+1<line.length()))
+				i++;
+			value+=line[i];
+		}
+		return i<line.length();
+	}
+	size_t end=line.find_first_of(",} \t", i);
+	value=line.substr(i, (end==string::npos)?string::npos:end-i);
+	return !value.empty();
 }
 
 
-// FUNCTION - Clear Outer Brackets
-
-// If output (differentiated) string is entirely enclosed in brackets, remove these brackets.
-void clear_outer_brackets(string & str){
-	if (outer_brackets(str)){ // If string is entirely enclosed by brackets...
-		str.erase(0,1); // Erase first bracket
-		str.erase(str.length()-1,1); // And erase last bracket
-	}
-}
-
-
-// FUNCTION - Outer Brackets
-
-// Returns true if a string is entirely enclosed by brackets.
-bool outer_brackets(string str){
-	if (str[0]=='('){ // If first character is '('
-		int brackets=1; // If 'brackets' is zero, brackets are closed at this point in the string.
-	    for (int i=1; i<str.length(); i++){ // For each character in string after initial bracket...
-			if (str[i]=='(')
-				brackets++;
-			if (str[i]==')')
-				brackets--;
-			if ((brackets==0)&&(i<(str.length()-1))) // If brackets are closed and we have not yet reached end of string (ie. no outer brackets)...
-				return false; // Return false because there are no outer brackets.
-	    }
-	return true; // If we have reached this point, there are outer brackets because the initial bracket was not closed in the middle of the string.
-	}
-	return false;
-}
-
-
-// FUNCTION - Clear Ones
-
-// If there are any instances of a function multipled or divided by 1, remove these.
-void clear_ones(string & str){
-	if (str.length()>4){
-		if (str.substr(0,2)=="1*")
-			str.erase(0,2);
-		if (str.substr(0,4)=="(1)*")
-			str.erase(0,4);
-		if (str.substr(str.length()-2,2)=="*1")
-			str.erase(str.length()-2,2);
-		if (str.substr(str.length()-2,4)=="*(1)")
-			str.erase(str.length()-2,4);
-		for (int i=0; i<str.length(); i++){
-			if (str.substr(i,3)=="+1*")
-				str.erase(i+1,2);
-			if (str.substr(i,5)=="+(1)*")
-				str.erase(i+1,4);
-			if (str.substr(i,3)=="-1*")
-				str.erase(i+1,2);
-			if (str.substr(i,5)=="-(1)*")
-				str.erase(i+1,4);
-			if (str.substr(i,3)=="(1*")
-				str.erase(i+1,2);
-			if (str.substr(i,3)=="*1+")
-				str.erase(i,2);
-			if (str.substr(i,5)=="*(1)+")
-				str.erase(i,4);
-			if (str.substr(i,3)=="*1-")
-				str.erase(i,2);
-			if (str.substr(i,5)=="*(1)-")
-				str.erase(i,4);
-			if (str.substr(i,3)=="*1)")
-				str.erase(i,2);
-			if (str.substr(i,3)=="*1*")
-				str.erase(i,2);
-			if (str.substr(i,5)=="*(1)*")
-				str.erase(i,4);
-			if (str.substr(i,3)=="/1*")
-				str.erase(i,2);
-			if (str.substr(i,5)=="/(1)*")
-				str.erase(i,4);
-			if (str.substr(i,3)=="/1-")
-				str.erase(i,2);
-			if (str.substr(i,5)=="/(1)-")
-				str.erase(i,4);
-			if (str.substr(i,3)=="/1)")
-				str.erase(i,2);
-			if (str.substr(i,3)=="/(1))")
-				str.erase(i,4);
-			if (str.substr(i,5)=="*(1))")
-				str.erase(i,4);
-			if (str.substr(i,5)=="((1)*")
-				str.erase(i+1,4);
-		}
-	}
-}
-
-
-// FUNCTION - Clear Zeros
-
-// If there are any instances of 0 added or removed from a function, remove them.
-
-void clear_zeros(string & str){
-	if (str.substr(0,2)=="0+")
-		str.erase(0,2);
-	if (str.substr(0,4)=="(0)+")
-		str.erase(0,4);
-	if (str.substr(0,2)=="0-")
-		str.erase(0,2);
-	if (str.substr(0,2)=="0-")
-		str.erase(0,4);
-	for (int i=0; i<str.length(); i++){
-		if (str.substr(i,3)=="+0+")
-			str.erase(i,2);
-		if (str.substr(i,5)=="+(0)+")
-			str.erase(i,4);
-		if (str.substr(i,3)=="+0-")
-			str.erase(i,2);
-		if (str.substr(i,5)=="+(0)-")
-			str.erase(i,4);
-		if (str.substr(i,3)=="-0+")
-			str.erase(i,2);
-		if (str.substr(i,5)=="-(0)+")
-			str.erase(i,4);
-		if (str.substr(i,3)=="-0-")
-			str.erase(i,2);
-		if (str.substr(i,5)=="-(0)-")
-			str.erase(i,4);
-		if (str.substr(i,3)=="(0+")
-			str.erase(i+1,2);
-		if (str.substr(i,3)=="(0-")
-			str.erase(i+1,2);
-		if (str.substr(i,3)=="+0)")
-			str.erase(i,2);
-		if (str.substr(i,3)=="-0)")
-			str.erase(i,2);
-	}
-}
-
-
-// FUNCTION - Clear Unnecessary Brackets
-
-// Clears any brackets enclosing terms that are part of a sum or difference. For example, (a+b)-(sin(x)*t)+(c/d) would become a+b-sin(x)*t+c/d.
-void clear_unnecessary_brackets(string & str){
-	terms_sum_difference sum_difference_terms=break_into_plus_minus(str); // If str is a sum or difference, break into terms.
-	for (int i=0; i<sum_difference_terms.indices.size(); i++){ // For each + or - symbol in sum/difference...
-		if (sum_difference_terms.terms[i][0]=='('){ // If term to the left of symbol is enclosed in brackets...
-			str.erase(sum_difference_terms.indices[i]-sum_difference_terms.terms[i].length(),1); // Remove first bracket of this term.
-			str.erase(sum_difference_terms.indices[i]-1,1); // Remove second bracket of this term.
-			if (i==(sum_difference_terms.indices.size()-1)){ // If this is the last symbol in sequence of sum/difference symbols...
-				str.erase(sum_difference_terms.indices[i]+1,1); // Erase first bracket in term to the right of this symbol.
-				str.erase(sum_difference_terms.indices[i]+sum_difference_terms.terms[i].length(),1); // Erase second bracket in this term.
-			}
+// FUNCTION - Read Batch Line
+
+// Reads an input line of batch mode: either a bare expression, or a JSON object with "function" and optionally "terms".
+void read_batch_line(const string & line, int number_of_terms, batch_line & entry){
+	entry.terms=number_of_terms;
+	entry.ok=true;
+	entry.output.clear();
+	size_t start=line.find_first_not_of(" \t\r");
+	if ((start!=string::npos)&&(line[start]=='{')){ // If the line is a JSON object...
+		string terms;
+		if (!json_field(line, "function", entry.function)){
+			entry.function=line;
+			entry.ok=false;
 		}
+		if (json_field(line, "terms", terms))
+			entry.terms=atoi(terms.c_str());
+	} else {
+		size_t end=line.find_last_not_of(" \t\r");
+		entry.function=(start==string::npos)?"":line.substr(start, end-start+1);
+	}
+	if ((entry.terms<1)||(entry.terms>server_term_limit))
+		entry.ok=false;
+}
+
+
+// FUNCTION - Differentiate Batch Line
+
+// Differentiates one batch line and sets its output to {"function": ..., "derivatives": [...]}, or to
+// {"function": ..., "error": ...} if it cannot be differentiated, with the position of a parse error if there was one.
+void differentiate_batch_line(derivative_session * session, batch_line & entry){
+	vector<string> derivatives;
+	session->error=parse_error();
+	if (entry.ok)
+		entry.ok=session_derivatives(session, entry.function, entry.terms, derivatives);
+	entry.output="{\"function\": "+json_escape(entry.function);
+	if (!entry.ok&&((entry.terms<1)||(entry.terms>server_term_limit)))
+		entry.output+=", \"error\": "+json_escape("terms must be from 1 to "+to_string(server_term_limit))+"}";
+	else if (!entry.ok)
+		entry.output+=", \"error\": "+json_escape(session->error.message.empty()?"could not parse":describe_parse_error(entry.function, session->error))+"}";
+	else {
+		entry.output+=", \"derivatives\": [";
+		for (int i=0; i<derivatives.size(); i++)
+			entry.output+=((i>0)?", ":"")+json_escape(derivatives[i]);
+		entry.output+="]}";
 	}
 }
 
 
-// FUNCTION - Clean Up
+// FUNCTION - Batch Worker
+
+// Differentiates lines of 'block' until none are left. Lines are handed out one at a time through 'next'.
+void batch_worker(vector<batch_line> & block, atomic<int> & next, derivative_session * session){
+	int i;
+	while ((i=next.fetch_add(1))<block.size())
+		differentiate_batch_line(session, block[i]);
+}
+
+
+// FUNCTION - Run Batch
+
+// Reads blocks of lines from 'in', differentiates each block on 'threads' threads, and writes the results in input
+// order. Each thread keeps its own session for the whole run. Blank lines are skipped.
+int run_batch(istream & in, ostream & out, int number_of_terms, int threads){
+	if (threads<=0)
+		threads=thread::hardware_concurrency();
+	threads=max(1, threads);
+	vector<derivative_session *> sessions(threads);
+	for (int w=0; w<threads; w++)
+		sessions[w]=create_derivative_session();
+	vector<batch_line> block;
+	string line;
+	int failures=0;
+	while (in){
+		block.clear();
+		while ((block.size()<batch_block_lines)&&getline(in, line)){ // Read a block of lines.
+			if (line.find_first_not_of(" \t\r")==string::npos)
+				continue;
+			block.push_back(batch_line());
+			read_batch_line(line, number_of_terms, block.back());
+		}
+		atomic<int> next(0);
+		vector<thread> workers;
+		for (int w=1; w<min(threads, (int)block.size()); w++)
+			workers.push_back(thread(batch_worker, ref(block), ref(next), sessions[w]));
+		batch_worker(block, next, sessions[0]); // The calling thread is worker 0.
+		for (int w=0; w<workers.size(); w++)
+			workers[w].join();
+		for (int i=0; i<block.size(); i++){ // Write results in input order.
+			out<<block[i].output<<'\n';
+			if (!block[i].ok)
+				failures++;
+		}
+		out.flush();
+	}
+	for (int w=0; w<threads; w++)
+		destroy_derivative_session(sessions[w]);
+	return failures;
+}
+
 
-// Takes an output (differentiated) string and puts it into a more legible form.
-void clean_up(string & str){
-	clear_duplicate_symbols(str);
-	clear_head_or_tail_symbols(str);
-	clear_outer_brackets(str);
-	clear_ones(str);
-	clear_zeros(str);
+// FUNCTION - Batch Command
+
+// Runs batch mode from the command line: Derivative_Calculator --batch [file] [--terms N] [--threads N]. Lines are read
+// from 'file', or from the standard input if no file (or -) is given.
+int batch_command(int argc, char * argv[]){
+	int number_of_terms=6, threads=0;
+	const char * fin=nullptr;
+	for (int i=2; i<argc; i++){ // For each argument after --batch...
+		if ((strcmp(argv[i], "--terms")==0)&&(i+1<argc))
+			number_of_terms=atoi(argv[++i]);
+		else if ((strcmp(argv[i], "--threads")==0)&&(i+1<argc))
+			threads=atoi(argv[++i]);
+		else if (strcmp(argv[i], "-")!=0)
+			fin=argv[i];
+	}
+	if ((number_of_terms<1)||(number_of_terms>server_term_limit)){
+		cerr<<"error: --terms must be from 1 to "<<server_term_limit<<endl;
+		return 1;
+	}
+	ios::sync_with_stdio(false);
+	int failures;
+	if (fin!=nullptr){
+		ifstream file(fin);
+		if (!file){
+			cerr<<"error: could not open "<<fin<<endl;
+			return 1;
+		}
+		failures=run_batch(file, cout, number_of_terms, threads);
+	} else
+		failures=run_batch(cin, cout, number_of_terms, threads);
+	return (failures==0)?0:1;
 }
 
-// END OF CLEANUP FUNCTIONS
+// END LIBRARY FUNCTIONS
 
 
 
-// START OF TAYLOR METHOD FUNCTIONS
+// START SERVER FUNCTIONS
 
+// Server mode keeps one process running, so that the caches built for one request are still warm for the next. Each
+// request is one line holding a JSON object, and is answered with one line holding a JSON object, which repeats the
+// request's "id" if it had one. Answers are written as soon as they are ready, so a client may send many requests
+// before reading any, and must match answers to requests by id. The requests are:
+//   {"id": 1, "op": "differentiate", "function": "exp(t)*x", "terms": 6}
+//     -> {"id": 1, "derivatives": ["exp(t)*x", ...]}
+//   {"id": 2, "op": "evaluate", "function": "exp(t)*x", "terms": 6, "x": 1, "t": 0.5}
+//     -> {"id": 2, "values": [x', x'', ...]} at the given x and t
+//   {"id": 3, "op": "solve", "function": "exp(t)*x", "initial": 1, "a": 0, "b": 2, "h": 0.01, "terms": 8,
+//    "engine": "jet", "backward": false}
+//     -> {"id": 3, "t": 2, "x": ..., "steps": 200}, as one instance of an ensemble
+//   {"id": 4, "op": "stats"} -> counts and latency percentiles of each kind of request, and cache hits
+//   {"id": 5, "op": "shutdown"} -> {"id": 5, "ok": true}, after which the server answers what it has already read and exits
+// A request that cannot be answered gets {"id": ..., "error": "..."} instead.
 
-// FUNCTION Evaluate
 
-// Evaluates an expression given by str, as a function of x and t, as well as other derivatives of x, held in 'derivatives'.
-double evaluate(string str, vector<string> derivatives, double x, double t){
+// FUNCTION - JSON Number
 
-	// STEP 1 - If original function is entirely enclosed by brackets, remove these brackets.
-	if (outer_brackets(str)) // If there are brackets enclosing a +- term, such as in (a+b)*c
-		return evaluate(str.substr(1,str.length()-2), derivatives, x, t);
+// Returns 'value' as a JSON number with all 17 significant digits, or null if it is infinite or not a number, which
+// JSON cannot hold (a solution that blows up within the interval ends at inf).
+string json_number(double value){
+	if (!isfinite(value))
+		return "null";
+	char text[32];
+	snprintf(text, sizeof(text), "%.17g", value);
+	return text;
+}
 
-	// STEP 2 - Test if function is a sum or difference, and if so differentiate and add/subtract these derivatives.
-	terms_sum_difference plus_minus=break_into_plus_minus(str); // Break into summed/subtracted terms.
 
-	if (plus_minus.indices.empty()==false){ // If string is a sum or difference...
-		double eval_plus_minus=evaluate(plus_minus.terms[0], derivatives, x, t);
-		for (int i=0; i<plus_minus.indices.size(); i++){
-			if (plus_minus.symbols[i]=='+')
-				eval_plus_minus=eval_plus_minus+evaluate(plus_minus.terms[i+1], derivatives, x, t);
-			else
-				eval_plus_minus=eval_plus_minus-evaluate(plus_minus.terms[i+1], derivatives, x, t);
+// FUNCTION - Server Percentile
+
+// Returns the latency below which 'fraction' of 'samples' lie, or 0 if there are none. Reorders 'samples'.
+double server_percentile(vector<double> & samples, double fraction){
+	if (samples.empty())
+		return 0;
+	size_t k=min(samples.size()-1, (size_t)(fraction*samples.size()));
+	nth_element(samples.begin(), samples.begin()+k, samples.end());
+	return samples[k];
+}
+
+
+// FUNCTION - Record Latency
+
+// Adds the latency of one request of kind 'op' to the statistics of 'state'.
+void record_latency(server_state & state, const string & op, double microseconds, bool ok){
+	lock_guard<mutex> guard(state.latency_lock);
+	server_latency & latency=state.latencies[op];
+	if (latency.samples.size()<server_latency_samples)
+		latency.samples.push_back(microseconds);
+	else
+		latency.samples[latency.count%server_latency_samples]=microseconds;
+	latency.count++;
+	if (!ok)
+		latency.errors++;
+}
+
+
+// FUNCTION - Server Stats
+
+// Returns the fields of a stats answer: for each kind of request, the number answered, the number of errors and the
+// 50th, 90th and 99th percentile and largest latency in microseconds; then the hits and misses of the result and
+// program caches.
+string server_stats(server_state & state){
+	ostringstream fields;
+	fields<<setprecision(6)<<"\"requests\": {";
+	{
+		lock_guard<mutex> guard(state.latency_lock);
+		vector<string> ops;
+		for (unordered_map<string, server_latency>::iterator itr=state.latencies.begin(); itr!=state.latencies.end(); ++itr)
+			ops.push_back(itr->first);
+		sort(ops.begin(), ops.end());
+		for (int i=0; i<ops.size(); i++){ // For each kind of request...
+			server_latency & latency=state.latencies[ops[i]];
+			vector<double> samples=latency.samples;
+			fields<<((i>0)?", ":"")<<json_escape(ops[i])<<": {\"count\": "<<latency.count<<", \"errors\": "<<latency.errors;
+			fields<<", \"p50_us\": "<<server_percentile(samples, 0.5)<<", \"p90_us\": "<<server_percentile(samples, 0.9);
+			fields<<", \"p99_us\": "<<server_percentile(samples, 0.99)<<", \"max_us\": "<<server_percentile(samples, 1.0)<<"}";
 		}
-		return eval_plus_minus;
 	}
+	{
+		lock_guard<mutex> guard(state.results_lock);
+		fields<<"}, \"result_cache\": {\"hits\": "<<state.result_hits<<", \"misses\": "<<state.result_misses<<", \"size\": "<<state.results.size()<<"}";
+	}
+	fields<<", \"program_cache\": {\"hits\": "<<state.program_hits<<", \"misses\": "<<state.program_misses<<"}";
+	return fields.str();
+}
 
-	// If we have reached this point, str was not a sum/difference, so we treat it as a product/quotient.
 
-	// STEP 3 - Test if function is a product or quotient, and if so use product/quotient rule to differentiate.
-	terms_product_quotient mult_divide=break_into_mult_divide(str); // Break into multiplied/divided terms.
+// FUNCTION - Server Program
 
-	if (mult_divide.index!=0){ // If string is a product or quotient...
-		if (mult_divide.symbol=='*') // If it is a product...
-			return evaluate(mult_divide.terms[0], derivatives, x, t)*evaluate(mult_divide.terms[1], derivatives, x, t);
-		else // If it is a quotient...
-			return evaluate(mult_divide.terms[0], derivatives, x, t)/evaluate(mult_divide.terms[1], derivatives, x, t);
+// Returns the program of 'worker' for 'function' with 'number_of_terms' terms and 'engine', compiling it (or loading it
+// from the program cache on disk) if the worker does not have it yet. Returns null, and says why in 'error', if
+// 'function' cannot be parsed.
+server_program * server_program_for(server_worker & worker, server_state & state, const string & function, int number_of_terms, coefficient_engine engine, string & error){
+	string key=function+"\n"+to_string(number_of_terms)+"\n"+to_string(engine);
+	unordered_map<string, unique_ptr<server_program> >::iterator found=worker.programs.find(key);
+	if (found!=worker.programs.end()){
+		state.program_hits++;
+		return found->second.get();
+	}
+	state.program_misses++;
+	unique_ptr<server_program> entry(new server_program());
+	parse_error parsed;
+	if (!start_sequence(entry->sequence, function, parsed)){ // Checked here, so that compile_function has nothing to report.
+		error=describe_parse_error(function, parsed);
+		return nullptr;
 	}
+	if (!compile_function(entry->sequence, function, "", number_of_terms, engine, entry->program)){
+		error="could not compile "+function;
+		return nullptr;
+	}
+	bool cached;
+	if (engine==NATIVE_ENGINE)
+		jit_compile(entry->program, cached); // If machine code cannot be built, the compiled expressions are run instead.
+	prepare_scratch(entry->program, entry->scratch);
+	if (engine==JET_ENGINE)
+		prepare_jet_scratch(entry->program, number_of_terms, entry->jets);
+	entry->values.assign(number_of_terms+1, 0);
+	if (worker.programs.size()>=server_program_limit)
+		worker.programs.clear();
+	return (worker.programs[key]=move(entry)).get();
+}
 
-	// If we have reached this point, str was neither a sum/difference nor a product/quotient, so we treat it as an individual elementary function.
 
-	// STEP 4 - Evaluate individual elementary function.
+// FUNCTION - Server Answer
 
-	if (str[0]=='-') // If function is negative...
-		return (-1)*evaluate(str.substr(1,str.length()-1), derivatives, x, t);
-	
-	// CASE 1: str is a constant
-	if (::atof(str.c_str())!=0.0){
-		return stod(str); // Its derivative is zero (we will remove any terms by which it is multiplied later)
+// Answers one request line, returning the fields of the answer without its id. Sets 'op' to the kind of request, and
+// 'ok' to false if the answer is an error. Answers to differentiate, evaluate and solve requests are kept in the result
+// cache of 'state', so a repeated request is answered without any work.
+string server_answer(server_state & state, server_worker & worker, const string & line, string & op, bool & ok){
+	string function, value;
+	ok=false;
+	if (!json_field(line, "op", op)){
+		op="unknown";
+		return "\"error\": \"no op given\"";
 	}
-
-	// CASE 2: str has an exponent
-	// CASE 2a: it is exp(____)
-	if (str.substr(0,3)=="exp"){
-		string y=str.substr(3,str.length()-3); // Take argument (as in exp(argument))
-		return exp(evaluate(y, derivatives, x, t)); // Derivative is argument' * exp(argument)
+	if (op=="stats"){
+		ok=true;
+		return server_stats(state);
+	}
+	if (op=="shutdown"){
+		state.stopping=true;
+		ok=true;
+		return "\"ok\": true";
+	}
+	if ((op!="differentiate")&&(op!="evaluate")&&(op!="solve")){
+		value=op;
+		op="unknown"; // Counted together, so that the statistics stay small.
+		return "\"error\": "+json_escape("unknown op "+value);
+	}
+	if (!json_field(line, "function", function))
+		return "\"error\": \"no function given\"";
+	int number_of_terms=json_field(line, "terms", value)?atoi(value.c_str()):6;
+	if ((number_of_terms<1)||(number_of_terms>server_term_limit))
+		return "\"error\": \"terms must be from 1 to "+to_string(server_term_limit)+"\"";
+
+	// The cache key is the request without its id, with every field this kind of request reads.
+	string key=op+"\n"+function+"\n"+to_string(number_of_terms);
+	const char * inputs[]={"x", "t", "initial", "a", "b", "h", "engine", "backward"};
+	for (int i=0; i<8; i++)
+		key+="\n"+(json_field(line, inputs[i], value)?value:string());
+	{
+		lock_guard<mutex> guard(state.results_lock);
+		unordered_map<string, string>::iterator found=state.results.find(key);
+		if (found!=state.results.end()){
+			state.result_hits++;
+			ok=(found->second.compare(0, 8, "\"error\":")!=0);
+			return found->second;
+		}
+		state.result_misses++;
 	}
-	// CASE 2b: it is any other kind of exponential
 
-	if (str.substr(0,3)=="pow"){ // pow(we,erty)  pow(t,2)
-		int index_of_comma; // Index of string at which comma appears.
-		for (int i=4; i<(str.length()-2); i++){ // For each element of argument to 'pow'...
-			if (str[i]==',') // If character is a comma...
-				index_of_comma=i; // Save this index.
+	ostringstream answer;
+	string error;
+	if (op=="differentiate"){
+		vector<string> derivatives;
+		worker.session.error=parse_error();
+		if (!session_derivatives(&worker.session, function, number_of_terms, derivatives))
+			error=describe_parse_error(function, worker.session.error);
+		answer<<"\"derivatives\": [";
+		for (int i=0; i<derivatives.size(); i++)
+			answer<<((i>0)?", ":"")<<json_escape(derivatives[i]);
+		answer<<"]";
+	} else if (op=="evaluate"){
+		double x=json_field(line, "x", value)?atof(value.c_str()):0;
+		double t=json_field(line, "t", value)?atof(value.c_str()):0;
+		server_program * entry=server_program_for(worker, state, function, number_of_terms, SYMBOLIC_ENGINE, error);
+		if (entry!=nullptr){
+			answer<<"\"values\": [";
+			for (int i=0; i<number_of_terms; i++)
+				answer<<((i>0)?", ":"")<<json_number(derivative_value(entry->program, i, entry->scratch, x, t));
+			answer<<"]";
+		}
+	} else { // solve
+		problem_instance instance={0, 0, 1, 0.01, 1};
+		coefficient_engine engine=JET_ENGINE;
+		if (json_field(line, "a", value))
+			instance.a=atof(value.c_str());
+		if (json_field(line, "b", value))
+			instance.b=atof(value.c_str());
+		if (json_field(line, "h", value))
+			instance.h=atof(value.c_str());
+		if (json_field(line, "engine", value))
+			engine=(value=="symbolic")?SYMBOLIC_ENGINE:((value=="native")?NATIVE_ENGINE:JET_ENGINE);
+		if (json_field(line, "backward", value)&&(value=="true"))
+			instance.forward_backward=2;
+		if (!json_field(line, "initial", value))
+			error="no initial value given";
+		else if (!(instance.h>0)||!(instance.b>=instance.a))
+			error="h must be positive and b no less than a";
+		else if (instance_steps(instance)<0)
+			error="too many steps of width h between a and b";
+		else {
+			instance.xa=atof(value.c_str());
+			server_program * entry=server_program_for(worker, state, function, number_of_terms, engine, error);
+			if (entry!=nullptr){
+				ensemble_result result=integrate_instance(entry->program, number_of_terms, engine, instance, entry->scratch, entry->jets, entry->values.data());
+				answer<<"\"t\": "<<json_number(result.t)<<", \"x\": "<<json_number(result.x)<<", \"steps\": "<<result.steps;
+			}
 		}
-		
-		return pow(evaluate(str.substr(4,(index_of_comma-4)), derivatives, x, t), evaluate(str.substr(index_of_comma+1,(str.length()-index_of_comma-2)), derivatives, x, t));
 	}
+	ok=error.empty();
+	string fields=ok?answer.str():"\"error\": "+json_escape(error);
+	lock_guard<mutex> guard(state.results_lock);
+	if (state.results.size()>=server_result_limit)
+		state.results.clear();
+	state.results[key]=fields;
+	return fields;
+}
 
-	// CASE 3: function is x or a derivative of x.
-	if (str=="x")
-		return x;
 
-	if (str=="x\'")
-		return evaluate(derivatives[0], derivatives, x, t);
+// FUNCTION - Send Answer
+
+// Writes 'text' to 'connection' in full. If the client has gone away, the connection is marked broken and later
+// answers to it are dropped.
+void send_answer(server_connection & connection, const string & text){
+	lock_guard<mutex> guard(connection.lock);
+	size_t written=0;
+	while (!connection.broken&&(written<text.size())){
+		ssize_t n=write(connection.out, text.data()+written, text.size()-written);
+		if ((n<0)&&(errno==EINTR))
+			continue;
+		if (n<=0)
+			connection.broken=true;
+		else
+			written+=n;
+	}
+}
 
-	if (str=="x\'\'")
-		return evaluate(derivatives[1], derivatives, x, t);
 
-	if (str=="x\'\'\'")
-		return evaluate(derivatives[2], derivatives, x, t);
+// FUNCTION - Server Worker Loop
+
+// Answers queued requests until the queue is empty and closed. The worker's caches live as long as the thread.
+void server_worker_loop(server_state & state){
+	server_worker worker;
+	for (;;){ // For each request...
+		server_job job;
+		{
+			unique_lock<mutex> guard(state.lock);
+			state.ready.wait(guard, [&](){ return !state.queue.empty()||state.closing; });
+			if (state.queue.empty()) // If closing and nothing is left...
+				return;
+			job=move(state.queue.front());
+			state.queue.pop_front();
+		}
+		string op, id;
+		bool ok;
+		string fields=server_answer(state, worker, job.line, op, ok);
+		string answer="{";
+		if (json_field(job.line, "id", id)) // Repeat the id, as a string if it was one.
+			answer+="\"id\": "+((job.line[json_value_position(job.line, "id")]=='"')?json_escape(id):id)+", ";
+		send_answer(*job.connection, answer+fields+"}\n");
+		record_latency(state, op, elapsed_ns(job.received)/1e3, ok);
+		if (op=="shutdown") // Get the I/O thread out of poll.
+			(void)!write(state.wake[1], "", 1);
+	}
+}
 
-	if (str=="x\'\'\'\'")
-		return evaluate(derivatives[3], derivatives, x, t);
 
-	// CASE 4: function is t
-	if (str=="t")
-		return t;
+// FUNCTION - Open Server Socket
 
-	// CASE 5: function is trigonometric.
-	if (str.substr(0,3)=="sin"){ // sin(234)
-		return sin(evaluate(str.substr(3, str.length()-3), derivatives, x, t));
+// Creates a Unix domain socket listening at 'path', removing a socket left there by an earlier run. Returns its
+// descriptor, or -1 if it cannot be created.
+int open_server_socket(const char * path){
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family=AF_UNIX;
+	if (strlen(path)>=sizeof(address.sun_path)){
+		cerr<<"error: socket path "<<path<<" is too long"<<endl;
+		return -1;
 	}
-
-	if (str.substr(0,3)=="cos"){
-		return cos(evaluate(str.substr(3, str.length()-3), derivatives, x, t));
+	strcpy(address.sun_path, path);
+	struct stat info;
+	if ((stat(path, &info)==0)&&S_ISSOCK(info.st_mode)) // Only a socket is removed, never another kind of file.
+		unlink(path);
+	int listener=socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if ((listener<0)||(bind(listener, (sockaddr *)&address, sizeof(address))!=0)||(listen(listener, 64)!=0)){
+		cerr<<"error: could not listen on "<<path<<": "<<strerror(errno)<<endl;
+		if (listener>=0)
+			close(listener);
+		return -1;
 	}
+	return listener;
+}
 
-	if (str.substr(0,3)=="tan"){
-		return tan(evaluate(str.substr(3, str.length()-3), derivatives, x, t));
-	}
 
-	// If there are +- terms within the */ term, re-iterate derivative process on them, such as (a+b)*c
-	for (int i=0; i<str.length(); i++){
-		if ((str[i]=='+')||(str[i]=='-')){
-			return evaluate(str, derivatives, x, t);
+// FUNCTION - Serve
+
+// Runs the I/O thread of server mode: accepts clients on 'listener' (if it is not -1), reads request lines from every
+// client and from 'standard' (if it is not null), and queues them for the workers, until a shutdown request has been
+// answered or, when serving the standard input, it ends.
+void serve(server_state & state, int listener, shared_ptr<server_connection> standard){
+	vector<shared_ptr<server_connection> > clients;
+	if (standard!=nullptr)
+		clients.push_back(standard);
+	vector<char> buffer(1<<16);
+	bool finished=false;
+	while (!finished&&!state.stopping){
+		vector<pollfd> fds(1, pollfd{state.wake[0], POLLIN, 0});
+		if (listener>=0)
+			fds.push_back(pollfd{listener, POLLIN, 0});
+		int first=fds.size(); // fds[first+i] is clients[i]
+		for (int i=0; i<clients.size(); i++)
+			fds.push_back(pollfd{clients[i]->in, POLLIN, 0});
+		if (poll(fds.data(), fds.size(), -1)<0){
+			if (errno==EINTR)
+				continue;
+			cerr<<"error: poll failed: "<<strerror(errno)<<endl;
+			break;
+		}
+		if (state.stopping)
+			break;
+		vector<server_job> jobs;
+		vector<bool> done(clients.size(), false);
+		for (int i=0; i<clients.size(); i++){ // For each client that has sent something...
+			if ((fds[first+i].revents&(POLLIN|POLLHUP|POLLERR))==0)
+				continue;
+			server_connection & client=*clients[i];
+			ssize_t n=read(client.in, buffer.data(), buffer.size());
+			if ((n<0)&&(errno==EINTR))
+				continue;
+			if (n<=0){ // If the client has finished sending...
+				done[i]=true;
+				continue;
+			}
+			client.pending.append(buffer.data(), n);
+			size_t start=0, end;
+			while ((end=client.pending.find('\n', start))!=string::npos){ // For each complete line...
+				size_t last=client.pending.find_last_not_of(" \t\r\n", end);
+				if ((last!=string::npos)&&(last>=start)&&(last<end))
+					jobs.push_back(server_job{clients[i], client.pending.substr(start, last-start+1), chrono::steady_clock::now()});
+				start=end+1;
+			}
+			client.pending.erase(0, start);
+			if (client.pending.size()>server_line_limit)
+				done[i]=true;
+		}
+		if (!jobs.empty()){
+			lock_guard<mutex> guard(state.lock);
+			for (int i=0; i<jobs.size(); i++)
+				state.queue.push_back(move(jobs[i]));
+		}
+		if (!jobs.empty())
+			state.ready.notify_all();
+		for (int i=clients.size()-1; i>=0; i--) // Let go of clients that are done; their last answers still get written.
+			if (done[i]){
+				if (clients[i]==standard)
+					finished=true;
+				clients.erase(clients.begin()+i);
+			}
+		if ((listener>=0)&&(fds[1].revents&POLLIN)){ // If a client is waiting to connect...
+			int fd=accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd>=0){
+				clients.push_back(make_shared<server_connection>());
+				clients.back()->in=fd;
+				clients.back()->out=fd;
+			}
 		}
 	}
+}
+
+
+// FUNCTION - Serve Command
+
+// Runs server mode from the command line: Derivative_Calculator --serve [socket] [--threads N]. Requests are taken from
+// clients of a Unix domain socket at 'socket', or from the standard input, with answers on the standard output, if no
+// socket (or -) is given. Statistics are written to the standard error when the server stops.
+int serve_command(int argc, char * argv[]){
+	const char * path=nullptr;
+	int threads=0;
+	for (int i=2; i<argc; i++){ // For each argument after --serve...
+		if ((strcmp(argv[i], "--threads")==0)&&(i+1<argc))
+			threads=atoi(argv[++i]);
+		else if (strcmp(argv[i], "-")!=0)
+			path=argv[i];
+	}
+	if (threads<=0)
+		threads=thread::hardware_concurrency();
+	threads=max(1, threads);
+	signal(SIGPIPE, SIG_IGN); // A client that goes away makes write fail, rather than ending the server.
+	server_state state;
+	if (pipe2(state.wake, O_CLOEXEC)!=0){
+		cerr<<"error: could not create pipe: "<<strerror(errno)<<endl;
+		return 1;
+	}
+	int listener=-1;
+	shared_ptr<server_connection> standard;
+	if (path!=nullptr){
+		listener=open_server_socket(path);
+		if (listener<0)
+			return 1;
+		cerr<<"listening on "<<path<<" with "<<threads<<" workers"<<endl;
+	} else {
+		standard=make_shared<server_connection>();
+		standard->in=0;
+		standard->out=1;
+	}
+	vector<thread> workers;
+	for (int w=0; w<threads; w++)
+		workers.push_back(thread(server_worker_loop, ref(state)));
+	serve(state, listener, standard);
+	{
+		lock_guard<mutex> guard(state.lock);
+		state.closing=true;
+	}
+	state.ready.notify_all();
+	for (int w=0; w<workers.size(); w++) // Workers answer what is left in the queue first.
+		workers[w].join();
+	if (listener>=0){
+		close(listener);
+		unlink(path);
+	}
+	close(state.wake[0]);
+	close(state.wake[1]);
+	cerr<<"{"<<server_stats(state)<<"}"<<endl;
 	return 0;
 }
 
+// END SERVER FUNCTIONS
 
-// FUNCTION - dx
 
-// Function handle passed to Taylor function that calls Evaluate on input string
-double dx(double t, double x, string str, vector<string> symbolic_derivatives){
-	return evaluate(str, symbolic_derivatives, x, t);
+
+// START BENCHMARK FUNCTIONS
+
+
+// Number of calls to operator new made by the program so far, by all threads. The benchmarks read it before and after a
+// case to find the number of allocations per operation. When built as a library, operator new is left alone, since it
+// belongs to the program that links the library, and no allocations are counted.
+atomic<long> allocation_count(0);
+
+#ifndef DERIVATIVE_CALCULATOR_LIBRARY
+
+// The replacements are kept out of line, so that the compiler does not pair the malloc in one with the free in the
+// other and warn about mismatched allocation functions.
+__attribute__((noinline)) void * operator new(size_t size){
+	allocation_count.fetch_add(1, memory_order_relaxed);
+	void * p=malloc((size==0)?1:size);
+	if (p==nullptr)
+		throw bad_alloc();
+	return p;
 }
 
+__attribute__((noinline)) void operator delete(void * p) noexcept{
+	free(p);
+}
 
-// FUNCTION - Reverse Array
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept{
+	free(p);
+}
+#endif
 
-// Function that reverses elements of array. Used to output results in order when doing backward Taylor method.
-  void reverse_array(double ar[], int size)
-  {
-    int i;
-    double temp[size];
-    for (i=0; i<size; i++)
-    {
-      temp[size-i-1]=ar[i];
-    }
-    for (i=0; i<size; i++)
-    {
-      ar[i]=temp[i];    
-    }
-  }
+// Minimum time spent on each benchmark case. Fast operations are repeated until this much time has passed.
+const double benchmark_min_ns=1e8;
 
+// Width h used when comparing scalar types. It is small enough that, with scalar_terms terms of the jet engine, the
+// truncation error is below the rounding error of every type but double_double.
+const double scalar_h=0.01;
+const int scalar_terms=16;
 
-// FUNCTION - Taylor
 
-// Implements Taylor Method
-void taylor(double x1(double, double, string, vector<string>), double t, double x, double h, int n, int a_or_b, char* fout, vector<string> symbolic_derivatives, int number_of_terms)
-  {
-    // Set up input/output
-    ofstream file(fout); // Create output stream for output file in which we will save results.
-    cout.setf(ios::left); // Left justify output
-    cout.setf(ios::showpoint); // Show decimal point
+// FUNCTION - Name Derivatives
 
-    // Declare variables for holding data
-    double x_1, x_2, x_3, x_4, x_5; // Variables to hold computed derivative values at each iteration.
-    double t_out[n+1], exact_out[n+1], x_out[n+1], error_out[n+1]; // Arrays for holding computed data.
+// Fills 'vector_of_derivatives' with the terms x, x', x'', etc, up to derivative number_of_terms.
+void name_derivatives(int number_of_terms, vector<string> & vector_of_derivatives){
+	vector_of_derivatives.assign(1, "x");
+	for (int i=1; i<=number_of_terms; i++) // For each derivative...
+		vector_of_derivatives.push_back(vector_of_derivatives[i-1]+"\'"); // Add an apostrophe to the previous term.
+}
 
-    // Row headers
-    cout<<"\n";
-    cout.width(7); cout<<"t ";
-    cout.width(19); cout<<"Exact ";
-    cout.width(19); cout<<"Taylor ";
-    cout.width(19); cout<<"Error";
-    cout<<"\n";
 
-    // Initial values
-    t_out[0]=t;
-    exact_out[0]=dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives);
-    x_out[0]=x;
-    error_out[0]=fabs(dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives) - x);
-    file << t << " " << dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives) << " " << x << " " << fabs(dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives) - x) << " ";
-    file << "\n";
+// FUNCTION - Symbolic Derivative Strings
+
+// Computes x', x'', etc, up to number_of_terms terms, in the same way as main(), and appends the exact solution. Returns
+// false if 'function' cannot be parsed.
+bool symbolic_derivative_strings(const string & function, const string & exact, int number_of_terms, vector<string> & symbolic_derivatives){
+	derivative_sequence sequence;
+	parse_error error;
+	if (!start_sequence(sequence, function, error))
+		return false;
+	symbolic_derivatives.assign(1, function);
+	for (int i=1; i<number_of_terms; i++) // For each derivative...
+		symbolic_derivatives.push_back(expression_to_string(sequence_term(sequence, i)));
+	symbolic_derivatives.push_back(exact);
+	return true;
+}
 
-    // Perform iterations of Taylor method
-    for (int i = 1; i <= n; i++)
-    {
-    	vector<double> derivatives;
-      // Compute derivatives
-    	for (int j=0; j<number_of_terms; j++)
-    		derivatives.push_back(dx(t,x, symbolic_derivatives[j], symbolic_derivatives));
-
-      int k=number_of_terms;
-      double p=derivatives[number_of_terms-1]*h/number_of_terms;
-      while(k>=2){
-      	p=(p+derivatives[k-2])*h/(k-1);
-        k=k-1;
-      }	
-      if (a_or_b==1) // If performing forward Taylor method...
-      {
-        // increment
-        x += p;
-        t+=h;
-      } else // If performing backward Taylor method...
-      {
-        // decrement
-        x -= p;
-        t-=h;
-      }
-      // Compute and save next set of values
-      t_out[i]=t;
-      exact_out[i]=dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives);
-      x_out[i]=x;
-      error_out[i]=fabs(dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives) - x);
-      file << t << " " << dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives) << " " << x << " " << fabs(dx(t, x, symbolic_derivatives[number_of_terms], symbolic_derivatives) - x) << " ";
-      file << "\n";
-    }
 
-    if (a_or_b==2) // If performing backward Taylor method...
-    {
-      // Reverse all arrays
-      reverse_array(t_out,sizeof(t_out)/sizeof(*t_out));
-      reverse_array(exact_out,sizeof(exact_out)/sizeof(*exact_out));
-      reverse_array(x_out,sizeof(x_out)/sizeof(*x_out));
-      reverse_array(error_out,sizeof(error_out)/sizeof(*error_out));
-    }
+// FUNCTION - Peak RSS
 
-    // Display computed values.
-    for (int i = 0; i <= n; i++)
-    {
-      if ((i%50)==0) // If t=1.00, 1.10, etc
-      {
-        cout << fixed;
-        cout << setprecision(2);
-        cout.width(6); cout << ((abs(t_out[i]) < 0.0005)? 0.000: t_out[i])<<" ";
-        cout << fixed;
-        cout << setprecision(13);
-        cout.width(18); cout<<exact_out[i]<<" ";
-        cout.width(18); cout<<x_out[i]<<" ";
-        cout.width(18); cout<<error_out[i];
-        cout<<"\n";
-      }
-    }
-    return;
-  }
+// Returns the largest resident set size the process has had so far, in kilobytes.
+long peak_rss_kb(){
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
 
 
-// FUNCTION - Solve Problem
+// FUNCTION - Time Operation
+
+// Calls 'op' repeatedly until benchmark_min_ns has passed, and records the mean time and number of allocations in
+// 'result'. Each call of 'op' counts as 'ops_per_call' operations (for example, the number of steps in a Taylor run).
+template<class operation> void time_operation(operation op, long ops_per_call, benchmark_result & result){
+	op(); // Warm up caches and lazily-built state.
+	long calls=0;
+	long allocations=allocation_count;
+	chrono::steady_clock::time_point start=chrono::steady_clock::now();
+	double elapsed;
+	do{
+		op();
+		calls++;
+		elapsed=chrono::duration<double, nano>(chrono::steady_clock::now()-start).count();
+	} while (elapsed<benchmark_min_ns);
+	result.iterations=calls*ops_per_call;
+	result.ns_per_op=elapsed/result.iterations;
+	result.allocations_per_op=double(allocation_count-allocations)/result.iterations;
+	result.peak_rss_kb=peak_rss_kb();
+}
 
-// Solves Problem from Final Project, now using symbolic derivatives rather than user-defined derivatives.
-int solve_problem(vector<string> derivatives, int number_of_terms, double h, double a, double b, double xa, int forward_backward)
-{
-	int start_s=clock();
 
-    // Define constants
-    double t;
-    if (forward_backward==1)
-    	t=a;
-    else
-    	t=b;
-    int n = (b - a) / h;
+// FUNCTION - Time Scalar
+
+// Times the Taylor method with numbers of type 'scalar' on 'problem', with width scalar_h, and records the error at the
+// end of the interval. The initial condition and the exact solution are both found from the exact solution in the
+// same type, so that the error shows the precision of the type rather than the rounding of x(a) to double.
+template<class scalar> benchmark_result time_scalar(const compiled_derivatives & program, int number_of_terms, coefficient_engine engine, const reference_problem & problem, const char * scalar_name){
+	benchmark_result result={"scalar", problem.function, number_of_terms, scalar_h, (engine==JET_ENGINE)?"jet":"symbolic", scalar_name};
+	basic_evaluation_scratch<scalar> scratch;
+	prepare_scratch(program, scratch);
+	basic_jet_scratch<scalar> jets;
+	if (engine==JET_ENGINE)
+		prepare_jet_scratch(program, number_of_terms, jets);
+	vector<scalar> values(number_of_terms+1);
+	long n=(problem.b-problem.a)/scalar_h;
+	scalar step=(problem.forward_backward==1)?scalar_h:-scalar_h;
+	scalar start=(problem.forward_backward==1)?problem.a:problem.b;
+	scalar t, x;
+	time_operation([&](){
+		t=start;
+		x=evaluate(program, number_of_terms, scratch, scalar(0), t); // x(a), from the exact solution
+		for (long i=0; i<n; i++){ // For each step...
+			x+=taylor_increment(dx<scalar>, program, number_of_terms, engine, scratch, jets, &values[0], x, t, step);
+			t+=step;
+		}
+	}, n, result);
+	result.error=double(fabs(evaluate(program, number_of_terms, scratch, x, t)-x));
+	result.expression_size=program.registers;
+	return result;
+}
 
-    // Execute Taylor Method
-    taylor(dx, t, xa, h, n, forward_backward, "solve_problem.dat", derivatives, number_of_terms);
-    int stop_s=clock();
-    cout<<endl<<"runtime: "<<(stop_s-start_s)/double(CLOCKS_PER_SEC)*1000<<" ms"<<endl;
-    return 0;
+
+// FUNCTION - Write Benchmark JSON
+
+// Writes all benchmark results to 'fout' as a JSON object, along with the compiler and batch kernel used, so that the
+// results of different builds can be compared.
+void write_benchmark_json(const vector<benchmark_result> & results, const char * fout){
+	ofstream file(fout);
+	file<<"{\n";
+	file<<"  \"compiler\": \""<<__VERSION__<<"\",\n";
+	file<<"  \"batch_kernel\": \""<<batch_kernel_name()<<"\",\n";
+	file<<"  \"min_time_ns\": "<<benchmark_min_ns<<",\n";
+	file<<"  \"peak_rss_kb\": "<<peak_rss_kb()<<",\n";
+	file<<"  \"results\": [\n";
+	for (int i=0; i<results.size(); i++){ // For each benchmark case...
+		const benchmark_result & result=results[i];
+		file<<"    {\"group\": \""<<result.group<<"\", \"problem\": \""<<result.problem<<"\", \"order\": "<<result.order;
+		if ((result.group=="taylor")||(result.group=="ensemble")||(result.group=="scalar"))
+			file<<", \"h\": "<<result.h<<", \"engine\": \""<<result.engine<<"\"";
+		if (result.group=="ensemble")
+			file<<", \"threads\": "<<result.threads;
+		if (result.group=="scalar")
+			file<<", \"scalar\": \""<<result.scalar<<"\", \"error\": "<<setprecision(6)<<result.error;
+		file<<", \"iterations\": "<<result.iterations<<", \"ns_per_op\": "<<setprecision(6)<<result.ns_per_op;
+		file<<", \"allocations_per_op\": "<<result.allocations_per_op<<", \"expression_size\": "<<result.expression_size;
+		file<<", \"peak_rss_kb\": "<<result.peak_rss_kb<<"}"<<((i+1<results.size())?",":"")<<"\n";
+	}
+	file<<"  ]\n";
+	file<<"}\n";
 }
 
-// END OF TAYLOR METHOD FUNCTIONS
+
+// FUNCTION - Run Benchmarks
+
+// Times output_derivative for derivative orders 1-12, evaluate on the derivatives of growing size that this produces,
+// taylor on the reference problems from main() for several widths h and numbers of terms, with both coefficient
+// engines, the symbolic and jet engines in float, double, long double and double_double, with the error each reaches,
+// and solve_ensemble for a sweep of initial conditions with increasing numbers of threads. Prints a summary and writes
+// the results to 'fout' as JSON.
+int run_benchmarks(const char * fout){
+	const int max_order=12;
+	reference_problem problems[2]={
+		{"x+pow(x,2)", "exp(t)/(16-exp(t))", 1.00, 2.77, exp(1)/(16-exp(1)), 1}, // Problem 1
+		{"exp(t)*x", "exp(exp(t)-exp(2))", 0, 2, 1, 2} // Problem 2
+	};
+	const double widths[2]={0.01, 0.001};
+	const int terms[3]={2, 4, 8};
+	vector<benchmark_result> results;
+
+	for (int p=0; p<2; p++){ // For each reference problem...
+		const reference_problem & problem=problems[p];
+
+		// Differentiation: parse, simplify and differentiate up to 'order', starting from an empty pool each time. The pool
+		// and cache are reset rather than rebuilt, so that their arenas keep their blocks, as in a long batch run.
+		expression_pool pool;
+		derivative_cache cache;
+		for (int order=1; order<=max_order; order++){
+			benchmark_result result={"derivative", problem.function, order, 0, ""};
+			const expression_node * expression;
+			time_operation([&](){
+				reset_pool(pool);
+				reset_cache(cache);
+				expression=simplify_expression(parse_expression(problem.function, pool), pool);
+				for (int i=0; i<order; i++)
+					expression=output_derivative(expression, pool, cache);
+			}, 1, result);
+			unordered_set<const expression_node *> visited; // Counted after timing; the nodes of the last run are still in the pool.
+			result.expression_size=count_nodes(expression, visited);
+			results.push_back(result);
+		}
+
+		// Evaluation: run the compiled derivative of each order at one point.
+		vector<string> symbolic_derivatives;
+		if (!symbolic_derivative_strings(problem.function, problem.exact, max_order+1, symbolic_derivatives))
+			return 1;
+		compiled_derivatives program;
+		if (!compile_derivatives(symbolic_derivatives, max_order+1, program))
+			return 1;
+		evaluation_scratch scratch;
+		prepare_scratch(program, scratch);
+		for (int order=1; order<=max_order; order++){
+			benchmark_result result={"evaluate", problem.function, order, 0, ""};
+			volatile double sink;
+			double x=problem.xa;
+			time_operation([&](){
+				scratch.values_valid=false; // Time a step's worth of work, not a lookup of values from the last run.
+				sink=evaluate(program, order, scratch, x, problem.a);
+			}, 1, result);
+			result.expression_size=0;
+			for (int i=0; i<=order; i++) // Derivative 'order' also runs every lower derivative, once each.
+				result.expression_size+=program.expressions[i].code.size();
+			results.push_back(result);
+		}
+
+		// Taylor method: full runs over the interval, timed per step. Output is discarded.
+		for (int w=0; w<2; w++){
+			for (int k=0; k<3; k++){
+				vector<string> derivatives;
+				compiled_derivatives taylor_program;
+				if (!symbolic_derivative_strings(problem.function, problem.exact, terms[k], derivatives))
+					return 1;
+				if (!compile_derivatives(derivatives, terms[k], taylor_program))
+					return 1;
+				long n=(problem.b-problem.a)/widths[w];
+				double t=(problem.forward_backward==1)?problem.a:problem.b;
+				for (int e=0; e<3; e++){ // For each coefficient engine...
+					coefficient_engine engine=(e==0)?SYMBOLIC_ENGINE:((e==1)?JET_ENGINE:NATIVE_ENGINE);
+					bool cached;
+					if ((engine==NATIVE_ENGINE)&&!jit_compile(taylor_program, cached)) // If there is no C compiler...
+						continue;
+					benchmark_result result={"taylor", problem.function, terms[k], widths[w], (e==0)?"symbolic":((e==1)?"jet":"native")};
+					step_control control={false, 0, 0};
+					streambuf * console=cout.rdbuf(nullptr); // Silence the table printed by taylor.
+					time_operation([&](){
+						taylor((engine==NATIVE_ENGINE)?dx_native<double>:dx<double>, t, problem.xa, widths[w], n, problem.forward_backward, "/dev/null", taylor_program, terms[k], engine, TEXT_FORMAT, control, nullptr);
+					}, n, result);
+					cout.rdbuf(console);
+					result.expression_size=taylor_program.registers;
+					results.push_back(result);
+				}
+			}
+		}
+	}
+
+	// Scalar types: speed and error of the symbolic engine (8 terms) and the jet engine (scalar_terms terms) in each type.
+	// Problem 1 is stopped at t=2, since near its pole at t=log(16) the error of every type is set by the step width.
+	for (int p=0; p<2; p++){ // For each reference problem...
+		reference_problem problem=problems[p];
+		if (p==0)
+			problem.b=2;
+		for (int e=0; e<2; e++){ // For each coefficient engine...
+			int number_of_terms=(e==0)?8:scalar_terms;
+			coefficient_engine engine=(e==0)?SYMBOLIC_ENGINE:JET_ENGINE;
+			vector<string> derivatives;
+			compiled_derivatives scalar_program;
+			if (!symbolic_derivative_strings(problem.function, problem.exact, (e==0)?number_of_terms:1, derivatives))
+				return 1;
+			if (engine==JET_ENGINE) // The jet engine only needs x'; the exact solution goes after the terms it would use.
+				derivatives.insert(derivatives.end()-1, number_of_terms-1, "0");
+			if (!compile_derivatives(derivatives, number_of_terms, scalar_program))
+				return 1;
+			results.push_back(time_scalar<float>(scalar_program, number_of_terms, engine, problem, "float"));
+			results.push_back(time_scalar<double>(scalar_program, number_of_terms, engine, problem, "double"));
+			results.push_back(time_scalar<long double>(scalar_program, number_of_terms, engine, problem, "long double"));
+			results.push_back(time_scalar<double_double>(scalar_program, number_of_terms, engine, problem, "double-double"));
+		}
+	}
+
+	// Ensemble: Problem 1 from 1024 initial conditions, timed per trajectory, for 1, 2, 4, ... worker threads.
+	vector<string> derivatives;
+	compiled_derivatives ensemble_program;
+	if (!symbolic_derivative_strings(problems[0].function, problems[0].exact, 4, derivatives))
+		return 1;
+	if (!compile_derivatives(derivatives, 4, ensemble_program))
+		return 1;
+	vector<problem_instance> instances(1024);
+	for (int i=0; i<instances.size(); i++){ // Sweep x(a) down from the Problem 1 initial condition.
+		problem_instance instance={problems[0].xa*(1-0.5*i/instances.size()), problems[0].a, problems[0].b, 0.01, 1};
+		instances[i]=instance;
+	}
+	vector<ensemble_result> ensemble_results;
+	int cores=max(1u, thread::hardware_concurrency());
+	for (int threads=1; ; threads*=2){
+		threads=min(threads, cores);
+		benchmark_result result={"ensemble", problems[0].function, 4, 0.01, "jet"};
+		result.threads=threads;
+		time_operation([&](){
+			solve_ensemble(ensemble_program, 4, JET_ENGINE, instances, ensemble_results, threads);
+		}, instances.size(), result);
+		result.expression_size=ensemble_program.registers;
+		results.push_back(result);
+		if (threads==cores)
+			break;
+	}
+
+	// Print summary.
+	cout<<endl<<left<<setw(12)<<"benchmark"<<setw(14)<<"problem"<<setw(7)<<"order"<<setw(8)<<"h"<<setw(10)<<"engine"<<setw(8)<<"threads";
+	cout<<right<<setw(14)<<"ns/op"<<setw(12)<<"allocs/op"<<setw(8)<<"size"<<"  "<<left<<setw(15)<<"scalar"<<"error"<<endl;
+	for (int i=0; i<results.size(); i++){ // For each benchmark case...
+		const benchmark_result & result=results[i];
+		cout<<left<<setw(12)<<result.group<<setw(14)<<result.problem<<setw(7)<<result.order<<setw(8);
+		if ((result.group=="taylor")||(result.group=="ensemble")||(result.group=="scalar"))
+			cout<<result.h;
+		else
+			cout<<"";
+		cout<<setw(10)<<result.engine<<setw(8)<<result.threads<<right<<fixed<<setprecision(1)<<setw(14)<<result.ns_per_op;
+		cout<<setprecision(2)<<setw(12)<<result.allocations_per_op<<setw(8)<<result.expression_size;
+		cout.unsetf(ios::fixed);
+		if (result.group=="scalar")
+			cout<<"  "<<left<<setw(15)<<result.scalar<<result.error;
+		cout<<endl;
+	}
+	cout<<endl<<"peak RSS: "<<peak_rss_kb()<<" kB"<<endl;
+	write_benchmark_json(results, fout);
+	cout<<"results written to "<<fout<<endl;
+	return 0;
+}
+
+// END BENCHMARK FUNCTIONS
 
 
 //////////
 
 
-int main()
+#ifndef DERIVATIVE_CALCULATOR_LIBRARY
+int main(int argc, char * argv[])
 {
+	if ((argc>1)&&(strcmp(argv[1], "--batch")==0)) // If run as "Derivative_Calculator --batch [file] [--terms N] [--threads N]"...
+		return batch_command(argc, argv);
+	if ((argc>1)&&(strcmp(argv[1], "--system")==0)) // If run as "Derivative_Calculator --system "f1;f2;..." --initial x1,x2,..."...
+		return system_command(argc, argv);
+	if ((argc>1)&&(strcmp(argv[1], "--parareal")==0)) // If run as "Derivative_Calculator --parareal "f" --initial xa"...
+		return parareal_command(argc, argv);
+	if ((argc>1)&&(strcmp(argv[1], "--serve")==0)) // If run as "Derivative_Calculator --serve [socket] [--threads N]"...
+		return serve_command(argc, argv);
+	if ((argc>1)&&(strcmp(argv[1], "--benchmark")==0)) // If run as "Derivative_Calculator --benchmark [results.json]"...
+		return run_benchmarks((argc>2)?argv[2]:"benchmark.json");
+	if ((argc>2)&&(strcmp(argv[1], "--read")==0)) // If run as "Derivative_Calculator --read solve_problem.bin"...
+		return print_results(argv[2]);
+
 	// Define variables
 	string function, exact, xa; // Function that we will receive as input from user, specifying x'(x,t).
 	int number_of_terms, forward_backward; // Number of terms desired in Taylor series expansion, also from input from user.
 	double h, a, b;
 	vector<string> vector_of_derivatives; // Vector of x, x', x'', etc terms
 	vector<string> symbolic_derivatives; // Vector of symbolic expressions for evaluated derivatives
+	derivative_sequence sequence; // Input function and its derivatives, made one order at a time as they are printed
+	parse_error error; // Where and why the input function could not be parsed, if it could not
 
 	// Gather user input.
 	cout<<endl<<"For all input, please use syntax that c++ can read, such as pow(x,2) rather than x^2."<<endl<<endl;
@@ -817,26 +6163,30 @@ int main()
 	//cin>>forward_backward;
 
 	// Save terms x, x', x'', etc in vector that we will pass by reference when differentiating input function.
-	vector_of_derivatives.push_back("x");
-	for (int i=1; i<=number_of_terms; i++){ // For each derivative...
-		vector_of_derivatives.push_back("x"); // Derivative terms begins with x.
-		for (int j=1; j<=i; j++) // And for each order of derivative...
-			vector_of_derivatives[i]=vector_of_derivatives[i]+"\'"; // Add an apostrophe.
-	}
+	name_derivatives(number_of_terms, vector_of_derivatives);
 
 	// Output computed derivatives.
+	if (!start_sequence(sequence, function, error)){ // Parse input function once.
+		cout<<endl<<"error: "<<describe_parse_error(function, error)<<endl<<endl;
+		return 1;
+	}
 	symbolic_derivatives.push_back(function); // Save original x' function in derivatives vector.
 	cout<<endl<<"Derivatives are:"<<endl<<endl<<"x' = "<<function<<endl<<endl;
 	for (int i=1; i<number_of_terms; i++){ // For each computed derivative...
-		function=output_derivative(function, vector_of_derivatives, number_of_terms); // Compute derivative...
+		function=expression_to_string(sequence_term(sequence, i)); // Compute derivative of previous one, sharing its nodes...
 		symbolic_derivatives.push_back(function); // ...and add to derivatives vector.
 		cout<<vector_of_derivatives[i+1]<<" = "<<function<<endl<<endl;
 	}
+	cout<<"Derivative cache: "<<sequence.cache.hits<<" hits, "<<sequence.cache.misses<<" misses"<<endl;
 
 	symbolic_derivatives.push_back(exact); // Append to end of derivatives vector.
 
 	// Now that we have gathered and computed derivatives, execute problem 1.
-	//solve_problem(symbolic_derivatives, number_of_terms, h, a, b, evaluate(xa, vector_of_derivatives, 0, 0), forward_backward);
+	// Fixed steps of width h; set adaptive to true to choose steps to meet the tolerances instead, and max_terms to let it
+	// raise the order too.
+	//step_control control={false, 1e-12, 1e-12, 0};
+	//solve_problem(symbolic_derivatives, number_of_terms, h, a, b, stod(xa), forward_backward, SYMBOLIC_ENGINE, TEXT_FORMAT, control, nullptr);
 
 	cout<<endl;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,76 @@
+#ifndef DERIVATIVE_CALCULATOR_H
+#define DERIVATIVE_CALCULATOR_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// SYMBOLIC DERIVATIVE CALCULATOR - Library Interface
+
+// Functions for differentiating many expressions from other programs. Compile Derivative_Calculator.cpp with
+// -DDERIVATIVE_CALCULATOR_LIBRARY to leave out main(), and link the object file with the program that includes this
+// header. Expressions use the same syntax as the interactive calculator, such as exp(t)*x or x+pow(x,2).
+
+
+// STRUCTURE Derivative Session
+
+// Structure that holds the state kept between expressions: the pool of expression nodes, the derivative and simplify
+// caches, and the interned symbol names. Expressions that share subexpressions reuse each other's work. A session must
+// only be used by one thread at a time; use one session per thread.
+struct derivative_session;
+
+
+// STRUCTURE Dense Solution
+
+// Structure that holds the Taylor polynomial of every step of a run, so that x can be found at any t in the interval
+// without running the method again. Step k is expanded about t[k], with coefficients (of powers of s-t[k]) from
+// coefficients[start[k]] up to coefficients[start[k+1]-1]; the number of them can change from step to step when the
+// order is raised. Steps are kept in order of increasing t. A forward step covers t[k] to t[k+1], and a backward step,
+// which is expanded about its right end, covers t[k-1] to t[k]. Values are kept in double whatever the scalar type.
+struct dense_solution{
+	std::vector<double> t; // expansion point of each step, increasing
+	std::vector<std::size_t> start; // index in 'coefficients' of the first coefficient of each step, and one past the last
+	std::vector<double> coefficients; // Taylor coefficients of all steps
+	bool backward; // true if the steps were expanded about their right ends
+	double lower, upper; // ends of the interval covered
+};
+
+
+// FUNCTION PROTOTYPES
+
+// Creates an empty session. Release it with destroy_derivative_session.
+derivative_session * create_derivative_session();
+
+// Releases a session and all of the expressions it holds.
+void destroy_derivative_session(derivative_session *);
+
+// Computes x', x'', etc, up to number_of_terms terms, for x' = 'function'. derivatives[0] is 'function' itself, and
+// derivatives[i] is derivative i+1 of x, written in terms of x, t and lower derivatives. Returns false if 'function'
+// cannot be parsed.
+bool session_derivatives(derivative_session *, const std::string & function, int number_of_terms, std::vector<std::string> & derivatives);
+
+// Returns what went wrong in the last call on 'session' that returned false, such as "expected ')'" for an expression
+// that cannot be parsed.
+std::string session_error(const derivative_session *);
+
+// Reads one expression per line from 'in' and writes one JSON object per line to 'out', in the same order. A line is
+// either a bare expression, differentiated to 'number_of_terms' terms, or a JSON object such as
+// {"function": "exp(t)*x", "terms": 6}. Lines are differentiated on 'threads' threads (one per core if 0). Returns the
+// number of lines that could not be differentiated.
+int run_batch(std::istream & in, std::ostream & out, int number_of_terms, int threads);
+
+// Solves x' = 'function' with the Taylor method to 'number_of_terms' terms, in steps of h from x=xa at a to b (or from b
+// to a, if 'backward'), keeping the Taylor polynomial of every step in 'dense' for dense_value and dense_values. Only x'
+// is compiled; the Taylor coefficients come from automatic differentiation, not from symbolic derivatives. Returns
+// false if 'function' cannot be parsed, if number_of_terms is less than 1, h is not positive or b is less than a, or if
+// the solution blows up before the end; 'dense' then covers the steps taken, if any.
+bool session_solve(derivative_session *, const std::string & function, int number_of_terms, double a, double b, double h, double xa, bool backward, dense_solution & dense);
+
+// Returns x at 'time' from 'dense', in O(log n) for n steps. 'dense' must hold at least one step; times outside
+// [dense.lower, dense.upper] use the polynomial of the nearest step.
+double dense_value(const dense_solution & dense, double time);
+
+// Sets x[i] to x at times[i] from 'dense', for 'count' times in increasing order, in one pass over the steps.
+void dense_values(const dense_solution & dense, const double * times, int count, double * x);
+
+#endif
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Regression tests for the Symbolic Derivative Calculator. Builds the calculator (or uses the binary given as the first
+# argument), then
+#   1) pipes server_requests.jsonl through --serve on the standard input and output, and compares the answers with
+#      server_expected.jsonl (latencies in the stats answer are not compared);
+#   2) evaluates the derivatives of the two reference problems with the evaluate request, and compares them with
+#      reference_values.txt, the values given by the original string-based differentiator.
+# Numbers are compared to a relative tolerance of 1e-12. Prints one line per failure and exits with 1 if any failed.
+
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+if [ -n "$1" ]; then
+	calculator=$1
+else
+	calculator=$work/Derivative_Calculator
+	${CXX:-g++} -O2 -pthread -o "$calculator" "$here/../Derivative_Calculator.cpp" -ldl || exit 1
+fi
+cd "$work" || exit 1 # The calculator writes its caches and result files relative to where it runs.
+export DERIVATIVE_PROGRAM_CACHE= # No program cache, so that every run compiles from scratch.
+
+# Compares two files line by line: numbers to a relative tolerance, everything else exactly.
+compare(){
+	awk -v name="$3" '
+		function split_line(line, parts){ gsub(/[][{},:]/, " & ", line); return split(line, parts, /[ \t]+/) }
+		function number(s){ return s ~ /^-?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?$/ }
+		NR==FNR { expected[FNR]=$0; lines=FNR; next }
+		{
+			n=split_line(expected[FNR], a); m=split_line($0, b); same=(n==m)
+			for (i=1; same&&(i<=n); i++)
+				if (number(a[i])&&number(b[i])){
+					scale=(a[i]<0)?-a[i]:a[i]
+					difference=a[i]-b[i]
+					if (difference<0) difference=-difference
+					same=(difference<=1e-12*((scale>1)?scale:1))
+				} else
+					same=(a[i]==b[i])
+			if (!same){ print name ": line " FNR ": expected " expected[FNR] ", got " $0; failed=1 }
+		}
+		END { if (FNR!=lines){ print name ": expected " lines " lines, got " FNR; failed=1 } exit failed }
+	' "$1" "$2"
+}
+
+failures=0
+
+# 1) Server protocol, one worker so that the answers come back in request order
+"$calculator" --serve --threads 1 < "$here/server_requests.jsonl" 2>/dev/null | sed -E 's/("(p50|p90|p99|max)_us": )[-0-9.e+]+/\1_/g' > server.out
+compare "$here/server_expected.jsonl" server.out server || failures=$((failures+1))
+
+# 2) Derivatives of the reference problems against the original differentiator
+grep -v '^#' "$here/reference_values.txt" > reference.txt
+awk '{ printf "{\"id\": %d, \"op\": \"evaluate\", \"function\": \"%s\", \"terms\": 5, \"x\": %s, \"t\": %s}\n", NR, $1, $2, $3 }' reference.txt > reference.jsonl
+awk '{ printf "{\"id\": %d, \"values\": [%s, %s, %s, %s, %s]}\n", NR, $4, $5, $6, $7, $8 }' reference.txt > reference_expected.jsonl
+"$calculator" --serve --threads 1 < reference.jsonl 2>/dev/null > reference.out
+compare reference_expected.jsonl reference.out reference || failures=$((failures+1))
+
+if [ $failures -eq 0 ]; then
+	echo "all tests passed"
+	exit 0
+fi
+exit 1